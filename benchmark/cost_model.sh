@@ -0,0 +1,100 @@
+#!/bin/bash
+# Compares the code size estimated by the cost model used for inlining with the code generated by PackCC,
+# for each grammar before and after optimization. Useful when updating the constants in src/cost_model.cc.
+# The costs are also fitted to the generated code of all rules (least squares, regularized towards the
+# current values, so that constructs missing in the grammars keep their cost) and the error is reported
+# for both the current and the fitted costs.
+
+fit() {
+    awk '
+        /^# / { grammar = $2; next }
+        /^ *Rule [^ ]+: estimated/ {
+            rows++
+            g[rows] = grammar
+            actual[rows] = $(index_of("generated") + 1)
+            for (i = index_of("constructs:") + 1; i <= NF; i++) {
+                split($i, kv, "=")
+                if (!(kv[1] in id)) { id[kv[1]] = ++n; name[n] = kv[1] }
+                x[rows, id[kv[1]]] = kv[2]
+            }
+        }
+        /^static const long COST/ { reading = 1; next }
+        reading && /^};/ { reading = 0 }
+        reading { sub(",", "", $1); current[$3] = $1 }
+        function index_of(word,    i) { for (i = 1; i <= NF; i++) if ($i == word) return i; return 0 }
+        function report(label, c,    r, k, predicted, total_p, total_a, rule_error, measured, gr, p, a) {
+            delete p; delete a
+            rule_error = 0; measured = 0
+            for (r = 1; r <= rows; r++) {
+                predicted = 0
+                for (k = 1; k <= n; k++) predicted += c[k] * x[r, k]
+                p[g[r]] += predicted; a[g[r]] += actual[r]
+                if (actual[r] > 0) { rule_error += (predicted > actual[r] ? predicted - actual[r] : actual[r] - predicted) / actual[r]; measured++ }
+            }
+            printf "%s costs: %.1f %% per rule on average", label, measured ? rule_error * 100 / measured : 0
+            for (gr in p) printf ", %s %+.1f %%", gr, a[gr] ? (p[gr] - a[gr]) * 100 / a[gr] : 0
+            printf "\n"
+        }
+        END {
+            for (k = 1; k <= n; k++) c0[k] = current[name[k]]
+            # normal equations of least squares with ridge towards the current costs
+            for (r = 1; r <= rows; r++) {
+                for (i = 1; i <= n; i++) {
+                    b[i] += x[r, i] * actual[r]
+                    for (j = 1; j <= n; j++) m[i, j] += x[r, i] * x[r, j]
+                }
+            }
+            trace = 0
+            for (i = 1; i <= n; i++) trace += m[i, i]
+            lambda = n ? 0.001 * trace / n : 0
+            for (i = 1; i <= n; i++) { m[i, i] += lambda; b[i] += lambda * c0[i] }
+            # Gaussian elimination with partial pivoting
+            for (i = 1; i <= n; i++) {
+                pivot = i
+                for (r = i + 1; r <= n; r++) if ((m[r, i] < 0 ? -m[r, i] : m[r, i]) > (m[pivot, i] < 0 ? -m[pivot, i] : m[pivot, i])) pivot = r
+                for (j = 1; j <= n; j++) { t = m[i, j]; m[i, j] = m[pivot, j]; m[pivot, j] = t }
+                t = b[i]; b[i] = b[pivot]; b[pivot] = t
+                for (r = i + 1; r <= n; r++) {
+                    f = m[r, i] / m[i, i]
+                    for (j = i; j <= n; j++) m[r, j] -= f * m[i, j]
+                    b[r] -= f * b[i]
+                }
+            }
+            for (i = n; i >= 1; i--) {
+                s = b[i]
+                for (j = i + 1; j <= n; j++) s -= m[i, j] * c1[j]
+                c1[i] = s / m[i, i]
+            }
+            for (k = 1; k <= n; k++) c1[k] = c1[k] < 0 ? 0 : int(c1[k] + 0.5)
+            print ""
+            for (k = 1; k <= n; k++) printf "%-16s %6d -> %6d\n", name[k], c0[k], c1[k]
+            report("current", c0)
+            report("fitted ", c1)
+        }
+    ' src/cost_model.cc -
+}
+
+main() {
+    set -e -o pipefail
+
+    export ROOTDIR="$(cd "$(dirname "$0")/.." && pwd)"
+    export PEGOF="build/pegof"
+    export OPTS="${OPTS:---optimize all}"
+
+    cd "$ROOTDIR"
+    make -C build pegof
+
+    LOG="$(mktemp)"
+    trap 'rm -f "$LOG"' EXIT
+    for GRAMMAR in benchmark/grammars/{c,calc,json,kotlin}.peg; do
+        echo "# $(basename "$GRAMMAR" .peg)"
+        "$PEGOF" -v -v -v $OPTS --output "/dev/null" -i "$GRAMMAR" 2>&1 | grep -E "^Code size of rules|Rule [^ ]+: estimated"
+    done > "$LOG"
+    awk '
+        /^# / { print ""; print; n = 0 }
+        /^Code size/ { sub(/^Code size of rules was estimated to /, "estimated "); print (n++ ? "output: " : "input:  ") $0 }
+    ' "$LOG"
+    fit < "$LOG"
+}
+
+main "$@"
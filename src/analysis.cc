@@ -0,0 +1,180 @@
+#include "analysis.h"
+#include "ast/visit.h"
+#include "packcc_wrapper.h"
+#include "config.h"
+#include "utils.h"
+#include "log.h"
+
+Analysis* Analysis::instance = nullptr;
+
+bool operator==(const Properties& a, const Properties& b) {
+    return a.first == b.first && a.nullable == b.nullable && a.always == b.always;
+}
+
+bool operator!=(const Properties& a, const Properties& b) {
+    return !(a == b);
+}
+
+Analysis::Analysis(Grammar& g) : g(g) {
+    std::vector<std::string> options = split(Config::get<std::string>("packcc-options"));
+    ascii = contains(options, "ascii") || contains(options, "a");
+    instance = this;
+}
+
+Analysis::~Analysis() {
+    if (instance == this) {
+        instance = nullptr;
+    }
+}
+
+CharSet Analysis::adjust(const CharSet& cs) const {
+    // in ascii mode, parser works with bytes, so we can only tell that the first byte is not ASCII
+    if (!ascii || cs.empty() || cs.max() < 0x80) {
+        return cs;
+    }
+    CharSet result = cs & CharSet(0, 0x7F);
+    result.add(0x80, 0xFF);
+    return result;
+}
+
+Properties Analysis::analyze_term(Term& term) const {
+    Properties inner = analyze(*term[0]);
+    if (term.is_negative()) {
+        // !X consumes nothing and fails whenever X matches
+        return {CharSet(), true, false};
+    } else if (term.is_prefixed()) {
+        // &X consumes nothing, but fails whenever X fails
+        return {CharSet(), true, inner.always};
+    } else if (term.is_optional()) {
+        return {inner.first, true, true};
+    }
+    return inner;
+}
+
+Properties Analysis::analyze(Node& node) const {
+    if (Alternation* a = node.as<Alternation>()) {
+        Properties result = {CharSet(), false, false};
+        for (int i = 0; i < a->size(); i++) {
+            Properties p = analyze(a->get(i));
+            result.first |= p.first;
+            result.nullable |= p.nullable;
+            result.always |= p.always;
+        }
+        return result;
+    } else if (Sequence* s = node.as<Sequence>()) {
+        Properties result = {CharSet(), true, true};
+        for (int i = 0; i < s->size(); i++) {
+            Properties p = analyze_term(s->get(i));
+            if (result.nullable) {
+                result.first |= p.first;
+            }
+            result.nullable &= p.nullable;
+            result.always &= p.always;
+        }
+        return result;
+    } else if (Term* t = node.as<Term>()) {
+        return analyze_term(*t);
+    } else if (String* str = node.as<String>()) {
+        const char* content = str->c_str();
+        if (!content[0]) {
+            return {CharSet(), true, true};
+        }
+        int c = (unsigned char)content[0];
+        if (!ascii) {
+            utf8_to_utf32(content, &c);
+        }
+        return {adjust(CharSet(c)), false, false};
+    } else if (CharacterClass* cc = node.as<CharacterClass>()) {
+        return {adjust(cc->get_charset()), false, false};
+    } else if (Reference* ref = node.as<Reference>()) {
+        return get(ref->get_name());
+    } else if (node.is<Action>()) {
+        return {CharSet(), true, true};
+    } else if (node.is<Expand>()) {
+        // expands can match any previously captured text, even empty one
+        return {adjust(CharSet::any()), true, false};
+    } else if (node.is<Group>() || node.is<Capture>() || node.is<Rule>()) {
+        return analyze(*node[0]);
+    }
+    error("unsupported type!");
+}
+
+void Analysis::update() {
+    rules.clear();
+    std::vector<Rule*> all = g.find_all<Rule>();
+    for (Rule* rule : all) {
+        rules[rule->get_name()] = {CharSet(), false, false};
+    }
+    // all properties only grow during the iteration, so this always reaches a fixpoint
+    int iterations = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (Rule* rule : all) {
+            Properties p = analyze(*rule);
+            if (p != rules[rule->get_name()]) {
+                rules[rule->get_name()] = p;
+                changed = true;
+            }
+        }
+        iterations++;
+    }
+    log(3, "Grammar analysis of %ld rules finished after %d iterations", all.size(), iterations);
+}
+
+std::vector<Rule*> Analysis::dependents(const Rule& rule) {
+    std::vector<Rule*> result;
+    for (Rule* r : g.find_all<Rule>()) {
+        bool references = !r->find_all<Reference>([&rule](const Reference& ref) -> bool {
+            return ref.references(&rule);
+        }).empty();
+        if (references) {
+            result.push_back(r);
+        }
+    }
+    return result;
+}
+
+void Analysis::update(Rule& rule) {
+    std::vector<Rule*> queue(1, &rule);
+    while (!queue.empty()) {
+        Rule* r = queue.back();
+        queue.pop_back();
+        Properties p = analyze(*r);
+        if (rules.count(r->get_name()) && p == rules[r->get_name()]) {
+            continue;
+        }
+        debug("Analysis of rule %s changed", r->c_str());
+        rules[r->get_name()] = p;
+        std::vector<Rule*> deps = dependents(*r);
+        queue.insert(queue.end(), deps.begin(), deps.end());
+    }
+}
+
+bool Analysis::is_ascii() const {
+    return ascii;
+}
+
+Properties Analysis::get(Node& node) const {
+    return analyze(node);
+}
+
+Properties Analysis::get(const std::string& rule) const {
+    std::map<std::string, Properties>::const_iterator it = rules.find(rule);
+    if (it == rules.end()) {
+        // rule defined elsewhere (e.g. in not followed import), assume the worst
+        return {adjust(CharSet::any()), true, false};
+    }
+    return it->second;
+}
+
+std::string Analysis::annotate(const Node& node) {
+    if (!instance) {
+        return "";
+    }
+    Properties p = instance->get(const_cast<Node&>(node));
+    std::string result = " {first: " + p.first.to_string();
+    if (p.nullable) result += ", nullable";
+    if (p.always) result += ", always";
+    return result + "}";
+}
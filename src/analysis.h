@@ -0,0 +1,43 @@
+#pragma once
+#include "ast/grammar.h"
+#include "charset.h"
+
+#include <map>
+#include <string>
+
+struct Properties {
+    CharSet first;      // characters that can start a non-empty match
+    bool nullable;      // might succeed without consuming any input
+    bool always;        // can never fail
+
+    friend bool operator==(const Properties& a, const Properties& b);
+};
+
+bool operator==(const Properties& a, const Properties& b);
+bool operator!=(const Properties& a, const Properties& b);
+
+class Analysis {
+    static Analysis* instance;
+
+    Grammar& g;
+    bool ascii;
+    std::map<std::string, Properties> rules;
+
+    Properties analyze(Node& node) const;
+    Properties analyze_term(Term& term) const;
+    CharSet adjust(const CharSet& cs) const;
+    std::vector<Rule*> dependents(const Rule& rule);
+public:
+    Analysis(Grammar& g);
+    ~Analysis();
+
+    void update();
+    void update(Rule& rule);
+
+    bool is_ascii() const;
+
+    Properties get(Node& node) const;
+    Properties get(const std::string& rule) const;
+
+    static std::string annotate(const Node& node);
+};
@@ -1,10 +1,14 @@
 #include "ast/action.h"
 #include "utils.h"
 #include "log.h"
-#include <regex>
 
-Action::Action(const std::string& code, Node* parent) : Node("Action", parent), code(code) {}
-Action::Action(Parser& p, Node* parent) : Node("Action", parent) {
+#include <algorithm>
+#include <cctype>
+
+Action::Action(const std::string& code, Node* parent) : Node(KIND, parent), code(code) {
+    index();
+}
+Action::Action(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
 
@@ -13,6 +17,7 @@ void Action::parse(Parser& p) {
     DebugIndent _;
     if (p.match_code()) {
         code = trim(p.last_match);
+        index();
         valid = true;
     }
 }
@@ -29,20 +34,118 @@ bool Action::is_multiline() const {
     return code.find('\n') != std::string::npos;
 }
 
+static bool is_identifier_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_identifier_char(char c) {
+    return is_identifier_start(c) || isdigit((unsigned char)c);
+}
+
+void Action::index() {
+    // single pass over the C code, collecting identifiers and capture references ($n, $ns, $ne),
+    // while skipping comments, string and character literals
+    captures.clear();
+    identifiers.clear();
+    size_t pos = 0;
+    while (pos < code.size()) {
+        char c = code[pos];
+        if (c == '/' && code.compare(pos, 2, "//") == 0) {
+            pos = code.find('\n', pos);
+        } else if (c == '/' && code.compare(pos, 2, "/*") == 0) {
+            pos = code.find("*/", pos + 2);
+            if (pos != std::string::npos) pos += 2;
+        } else if (c == '"' || c == '\'') {
+            pos++;
+            while (pos < code.size() && code[pos] != c) {
+                pos += code[pos] == '\\' ? 2 : 1;
+            }
+            pos++;
+        } else if (c == '$' && pos + 1 < code.size() && code[pos + 1] == '$') {
+            pos += 2;
+        } else if (c == '$' && pos + 1 < code.size() && isdigit((unsigned char)code[pos + 1])) {
+            size_t end = pos + 1;
+            while (end < code.size() && isdigit((unsigned char)code[end])) end++;
+            size_t number_end = end;
+            if (end < code.size() && (code[end] == 's' || code[end] == 'e')) end++;
+            if (end == code.size() || !is_identifier_char(code[end])) {
+                captures.push_back({(int)pos + 1, (int)(number_end - pos - 1), std::stoi(code.substr(pos + 1, number_end - pos - 1))});
+            }
+            pos = end;
+        } else if (is_identifier_start(c)) {
+            size_t end = pos;
+            while (end < code.size() && is_identifier_char(code[end])) end++;
+            size_t before = pos > 0 ? code.find_last_not_of(" \t\n", pos - 1) : std::string::npos;
+            bool member = before != std::string::npos
+                && (code[before] == '.' || (code[before] == '>' && before > 0 && code[before - 1] == '-'));
+            identifiers.push_back({(int)pos, code.substr(pos, end - pos), member});
+            pos = end;
+        } else if (isdigit((unsigned char)c)) {
+            // skip numbers, so that suffixes (e.g. 10UL) are not considered identifiers
+            while (pos < code.size() && is_identifier_char(code[pos])) pos++;
+        } else {
+            pos++;
+        }
+    }
+}
+
 bool Action::contains_reference(const Reference& ref) const {
-    std::regex re(".*\\b" + ref.var + "\\b.*");
-    return std::regex_match(code, re);
+    return std::any_of(identifiers.begin(), identifiers.end(), [&ref](const IdentifierUse& use) {
+        return use.name == ref.var;
+    });
+}
+
+int Action::count_variable(const std::string& name) const {
+    return std::count_if(identifiers.begin(), identifiers.end(), [&name](const IdentifierUse& use) {
+        return use.name == name && !use.member;
+    });
+}
+
+bool Action::uses_only(const std::set<std::string>& names) const {
+    return std::all_of(identifiers.begin(), identifiers.end(), [&names](const IdentifierUse& use) {
+        return names.count(use.name) > 0;
+    });
+}
+
+void Action::replace_variable(const std::string& name, const std::string& replacement) {
+    // going from the back keeps the recorded positions valid
+    for (int i = identifiers.size() - 1; i >= 0; i--) {
+        if (identifiers[i].name != name || identifiers[i].member) continue;
+        code.replace(identifiers[i].offset, name.size(), replacement);
+    }
+    index();
+}
+
+const std::string& Action::get_code() const {
+    return code;
 }
 
 bool Action::contains_capture(int i) const {
-    std::regex re(".*\\$" + std::to_string(i) + "[se]?\\b.*");
-    return std::regex_match(code, re);
+    return std::any_of(captures.begin(), captures.end(), [i](const CaptureUse& use) {
+        return use.index == i;
+    });
 }
 
 void Action::renumber_capture(int from, int to) {
-    code = replace(code, "\\$" + std::to_string(from) + "\\b", "$$" + std::to_string(to));
-    code = replace(code, "\\$" + std::to_string(from) + "s\\b", "$$" + std::to_string(to) + "s");
-    code = replace(code, "\\$" + std::to_string(from) + "e\\b", "$$" + std::to_string(to) + "e");
+    // patch the recorded positions, adjusting the following ones (including identifiers) if the number
+    // of digits changes, both lists are ordered by position
+    std::string replacement = std::to_string(to);
+    int delta = 0;
+    std::size_t identifier = 0;
+    for (CaptureUse& use : captures) {
+        for (; identifier < identifiers.size() && identifiers[identifier].offset < use.offset; identifier++) {
+            identifiers[identifier].offset += delta;
+        }
+        use.offset += delta;
+        if (use.index != from) continue;
+        code.replace(use.offset, use.length, replacement);
+        delta += replacement.size() - use.length;
+        use.length = replacement.size();
+        use.index = to;
+    }
+    for (; identifier < identifiers.size(); identifier++) {
+        identifiers[identifier].offset += delta;
+    }
 }
 
 bool operator==(const Action& a, const Action& b) {
@@ -2,9 +2,30 @@
 #include "ast/node.h"
 #include "ast/reference.h"
 
+#include <set>
+#include <vector>
+
 class Action : public Node {
+    struct CaptureUse {
+        int offset;     // position of the number in code
+        int length;     // number of digits
+        int index;
+    };
+
+    struct IdentifierUse {
+        int offset;     // position of the identifier in code
+        std::string name;
+        bool member;    // used after '.' or '->', so it can't be a variable
+    };
+
     std::string code;
+    std::vector<CaptureUse> captures;
+    std::vector<IdentifierUse> identifiers;
+
+    void index();
 public:
+    static const NodeKind KIND = NK_ACTION;
+
     Action(const std::string& code, Node* parent);
     Action(Parser& p, Node* parent);
 
@@ -17,6 +38,10 @@ public:
     bool contains_reference(const Reference& ref) const;
     bool contains_capture(int i) const;
     void renumber_capture(int from, int to);
+    int count_variable(const std::string& name) const;
+    bool uses_only(const std::set<std::string>& names) const;
+    void replace_variable(const std::string& name, const std::string& replacement);
+    const std::string& get_code() const;
 
     friend bool operator==(const Action& a, const Action& b);
 };
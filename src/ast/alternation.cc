@@ -1,13 +1,14 @@
 #include "ast/alternation.h"
 #include "rule.h"
 #include "config.h"
+#include "analysis.h"
 #include "log.h"
 
-Alternation::Alternation(const std::vector<Sequence>& sequences, Node* parent) : Node("Alternation", parent), sequences(sequences) {}
-Alternation::Alternation(Parser& p, Node* parent) : Node("Alternation", parent) {
+Alternation::Alternation(const std::vector<Sequence>& sequences, Node* parent) : Node(KIND, parent), sequences(sequences) {}
+Alternation::Alternation(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
-Alternation::Alternation(Node* parent) : Node("Alternation", parent) {}
+Alternation::Alternation(Node* parent) : Node(KIND, parent) {}
 
 void Alternation::parse(Parser& p) {
     debug("Parsing Alternation");
@@ -45,7 +46,7 @@ std::string Alternation::to_string(std::string indent) const {
 }
 
 std::string Alternation::dump(std::string indent) const {
-    std::string result = indent + "ALTERNATION" + "\n";
+    std::string result = indent + "ALTERNATION" + Analysis::annotate(*this) + "\n";
     for (int i = 0; i < sequences.size(); i++) {
         if (i > 0) result += "\n";
         result += sequences[i].dump(indent + "  ");
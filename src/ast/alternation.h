@@ -5,6 +5,8 @@
 class Alternation : public Node {
     std::vector<Sequence> sequences;
 public:
+    static const NodeKind KIND = NK_ALTERNATION;
+
     Alternation(const std::vector<Sequence>& sequences, Node* parent);
     Alternation(Parser& p, Node* parent);
     Alternation(Node* parent);
@@ -2,11 +2,21 @@
 #include "ast/alternation.h"
 #include "log.h"
 
-Capture::Capture(const Alternation& expression, Node* parent) : Node("Capture", parent), expression(new Alternation(expression)), num(-1) {}
-Capture::Capture(Parser& p, Node* parent) : Node("Capture", parent) {
+Capture::Capture(const Alternation& expression, Node* parent) : Node(KIND, parent), expression(new Alternation(expression)), num(-1) {}
+Capture::Capture(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
 
+// the expression is copied too, so that the copies can be modified independently
+Capture::Capture(const Capture& other) : Node(other), expression(other.expression ? new Alternation(*other.expression) : nullptr), num(other.num) {}
+
+Capture& Capture::operator=(const Capture& other) {
+    Node::operator=(other);
+    expression.reset(other.expression ? new Alternation(*other.expression) : nullptr);
+    num = other.num;
+    return *this;
+}
+
 void Capture::parse(Parser& p) {
     debug("Parsing Capture");
     DebugIndent _;
@@ -38,8 +48,8 @@ std::string Capture::to_string(std::string indent) const {
     } else {
         result = "<" + expression->to_string(indent) + ">";
     }
-    if (!post_comment.empty()) {
-        result += " #" + post_comment;
+    if (has_post_comment()) {
+        result += " #" + get_post_comment();
     }
     return result;
 }
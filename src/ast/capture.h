@@ -9,8 +9,12 @@ class Capture : public Node {
     std::shared_ptr<Alternation> expression;
     int num;
 public:
+    static const NodeKind KIND = NK_CAPTURE;
+
     Capture(const Alternation& expression, Node* parent);
     Capture(Parser& p, Node* parent);
+    Capture(const Capture& other);
+    Capture& operator=(const Capture& other);
 
     virtual void parse(Parser& p);
     virtual std::string to_string(std::string indent = "") const override;
@@ -20,6 +24,7 @@ public:
     virtual Node* operator[](int index);
     virtual long size() const;
 
+    Alternation& get_expression() { return *expression; }
     bool has_single_term() const;
 
     Group convert_to_group();
@@ -3,16 +3,24 @@
 #include "utils.h"
 #include "log.h"
 
+#include <algorithm>
 #include <cstring>
-#include <sstream>
-#include <iomanip>
-#include <numeric>
 
-CharacterClass::CharacterClass(const std::string& content, Node* parent) : Node("CharacterClass", parent), content(content), dash(false), negation(false) {
+CharacterClass::CharacterClass(const std::string& content, Node* parent) : Node(KIND, parent), any(false), dash(false), negation(false) {
     Parser p(content);
     parse(p);
 }
-CharacterClass::CharacterClass(Parser& p, Node* parent) : Node("CharacterClass", parent), dash(false), negation(false) {
+CharacterClass::CharacterClass(const CharSet& chars, Node* parent) : Node(KIND, parent), any(false), dash(false), negation(false) {
+    valid = true;
+    if (chars.is_any()) {
+        any = true;
+        return;
+    }
+    negation = chars.contains(CharSet::MAX);
+    this->chars = negation ? chars.complement() : chars;
+    tokens = canonical_tokens(dash);
+}
+CharacterClass::CharacterClass(Parser& p, Node* parent) : Node(KIND, parent), any(false), dash(false), negation(false) {
     parse(p);
 }
 
@@ -25,27 +33,6 @@ static std::string unescape(const std::string& s) {
     return result;
 }
 
-static std::string to_char(int c) {
-    if (c > 127) {
-        std::stringstream ss;
-        ss << "\\u" << std::setfill('0') << std::setw(4) << std::hex << c;
-        return ss.str();
-    }
-    switch (c) {
-    case '\r': return R"(\r)";
-    case '\n': return R"(\n)";
-    case '\t': return R"(\t)";
-    case '\v': return R"(\v)";
-    case '\f': return R"(\f)";
-    case '[': return R"(\[)";
-    case ']': return R"(\])";
-    case '^': return R"(\^)";
-    case '-': return R"(\-)";
-    case '\\': return R"(\\)";
-    default: return std::string(1, (char)c);
-    }
-}
-
 static int get_char(const std::string& s, int& pos) {
     int result;
     pos += utf8_to_utf32(s.c_str() + pos, &result);
@@ -63,6 +50,7 @@ static int get_char(const std::string& s, int& pos) {
 void CharacterClass::parse_content(Parser& p) {
     negation = p.match('^');
     dash = p.match('-');
+    std::string content;
     while (!p.is_eof()) {
         if (p.match(']')) break;
         content += p.current();
@@ -72,18 +60,17 @@ void CharacterClass::parse_content(Parser& p) {
         }
         p.match_any();
     }
-    content = unescape(content);
-    tokenize();
-    update_content();
+    tokenize(unescape(content));
 }
 
-void CharacterClass::tokenize() {
+void CharacterClass::tokenize(const std::string& content) {
     tokens.clear();
     int pos = 0;
     while (pos < content.size()) {
         Token result;
         result.first = get_char(content, pos);
-        if (content[pos] == '-') {
+        // trailing dash is just a character
+        if (content[pos] == '-' && pos + 1 < content.size()) {
             pos++;
             result.second = get_char(content, pos);
         } else {
@@ -91,6 +78,10 @@ void CharacterClass::tokenize() {
         }
         tokens.push_back(result);
     }
+    chars = CharSet(tokens);
+    if (dash) {
+        chars.add('-', '-');
+    }
 }
 
 void CharacterClass::parse(Parser& p) {
@@ -99,7 +90,7 @@ void CharacterClass::parse(Parser& p) {
     Parser::State s = p.save_point();
     p.skip_space();
     if (p.match('.')) {
-        content = ".";
+        any = true;
     } else if (p.match('[')) {
         parse_content(p);
     } else {
@@ -110,44 +101,37 @@ void CharacterClass::parse(Parser& p) {
     valid = true;
 }
 
-void CharacterClass::update_content() {
-    if (any_char()) return;
-
-    content = "";
-
-    for (size_t i = 0; i<tokens.size(); i++) {
-        size_t size = tokens[i].second - tokens[i].first;
-        switch (size) {
-        case 0:
-            content += to_char(tokens[i].first);
-            break;
-        case 1:
-            content += to_char(tokens[i].first);
-            content += to_char(tokens[i].second);
-            break;
-        default:
-            content += to_char(tokens[i].first);
-            content += '-';
-            content += to_char(tokens[i].second);
-            break;
+std::string CharacterClass::render_content() const {
+    if (any) return ".";
+
+    std::string content;
+    for (const Token& token : tokens) {
+        content += CharSet::format_char(token.first);
+        if (token.second != token.first) {
+            // adjacent characters don't need a dash
+            if (token.second != token.first + 1) {
+                content += '-';
+            }
+            content += CharSet::format_char(token.second);
         }
     }
+    return content;
 }
 
 std::string CharacterClass::to_string(std::string indent) const {
-    if (any_char()) {
+    if (any) {
         return ".";
     } else {
         std::string result = "[";
         if(negation) result += '^';
         if(dash) result += '-';
-        result += content + ']';
+        result += render_content() + ']';
         return result;
     }
 }
 
 std::string CharacterClass::dump(std::string indent) const {
-    return indent + "CHAR_CLASS " + content;
+    return indent + "CHAR_CLASS " + render_content();
 }
 
 bool CharacterClass::is_multiline() const {
@@ -155,23 +139,32 @@ bool CharacterClass::is_multiline() const {
 }
 
 bool CharacterClass::normalize() {
-    if (tokens.empty()) {
+    if (any) {
         return false;
     }
-    std::string original = content;
-    sort(tokens.begin(), tokens.end());
-    Tokens init(1, tokens[0]);
-    tokens = accumulate(tokens.begin() + 1, tokens.end(), init, [](Tokens& acc, const Token& item){
-        Token& prev = acc.back();
-        if (prev.second + 1 < item.first) {
-            acc.push_back(item);
-        } else if (item.second > prev.second) {
-            prev.second = item.second;
-        }
-        return acc;
+    bool leading_dash;
+    Tokens normalized = canonical_tokens(leading_dash);
+    if (normalized == tokens && leading_dash == dash) {
+        return false;
+    }
+    std::string original = to_string();
+    tokens = normalized;
+    dash = leading_dash;
+    return to_string() != original;
+}
+
+CharacterClass::Tokens CharacterClass::canonical_tokens(bool& leading_dash) const {
+    // '-' between other characters would be parsed as a range, so it must be written first,
+    // unless it is in the middle of a wider range, leading dash then doesn't have to be repeated
+    Tokens ranges = chars.ranges();
+    bool inside = std::any_of(ranges.begin(), ranges.end(), [](const Token& t) {
+        return t.first < '-' && t.second > '-';
     });
-    update_content();
-    return content != original;
+    leading_dash = chars.contains('-') && (dash || !inside);
+    if (!leading_dash) {
+        return ranges;
+    }
+    return (chars & CharSet('-').complement()).ranges();
 }
 
 void CharacterClass::flip_negation() {
@@ -179,7 +172,7 @@ void CharacterClass::flip_negation() {
 }
 
 bool CharacterClass::any_char() const {
-    return content == ".";
+    return any;
 }
 
 int CharacterClass::token_count() const {
@@ -187,27 +180,52 @@ int CharacterClass::token_count() const {
 }
 
 bool CharacterClass::is_single_char() const {
-    int size = content.size() + (dash ? 1 : 0);
-    return size == 1;
+    return !any && !chars.empty() && chars.min() == chars.max();
 }
 
 bool CharacterClass::is_negative() const {
     return negation;
 }
 
+CharSet CharacterClass::get_charset() const {
+    if (any) {
+        return CharSet::any();
+    }
+    return negation ? chars.complement() : chars;
+}
+
+static std::string to_utf8(int c) {
+    std::string result;
+    if (c < 0x80) {
+        result += (char)c;
+    } else if (c < 0x800) {
+        result += (char)(0xC0 | (c >> 6));
+        result += (char)(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        result += (char)(0xE0 | (c >> 12));
+        result += (char)(0x80 | ((c >> 6) & 0x3F));
+        result += (char)(0x80 | (c & 0x3F));
+    } else {
+        result += (char)(0xF0 | (c >> 18));
+        result += (char)(0x80 | ((c >> 12) & 0x3F));
+        result += (char)(0x80 | ((c >> 6) & 0x3F));
+        result += (char)(0x80 | (c & 0x3F));
+    }
+    return result;
+}
+
 String CharacterClass::convert_to_string() const {
-    return String(dash ? "-" : content, parent);
+    return String(to_utf8(chars.min()), parent);
 }
 
 void CharacterClass::merge(const CharacterClass& cc) {
     dash |= cc.dash;
-    content += cc.content;
-    tokenize();
-    update_content();
+    tokens.insert(tokens.end(), cc.tokens.begin(), cc.tokens.end());
+    chars |= cc.chars;
 }
 
 bool operator==(const CharacterClass& a, const CharacterClass& b) {
-    return a.negation == b.negation && a.dash == b.dash && a.content == b.content;
+    return a.any == b.any && a.negation == b.negation && a.chars == b.chars;
 }
 
 bool operator!=(const CharacterClass& a, const CharacterClass& b) {
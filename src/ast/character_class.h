@@ -1,22 +1,27 @@
 #pragma once
 #include "ast/node.h"
 #include "ast/string.h"
+#include "charset.h"
 
 class CharacterClass : public Node {
-    std::string content;
-
-    using Token = std::pair<int, int>;
-    using Tokens = std::vector<Token>;
+    using Token = CharSet::Range;
+    using Tokens = CharSet::Ranges;
 
+    bool any;
     bool dash;
     bool negation;
-    Tokens tokens;
+    Tokens tokens;  // ranges as written in the grammar, only used for formatting
+    CharSet chars;  // all listed characters (including dash), regardless of negation
 
     void parse_content(Parser& p);
-    void tokenize();
-    void update_content();
+    void tokenize(const std::string& content);
+    std::string render_content() const;
+    Tokens canonical_tokens(bool& leading_dash) const;
 public:
+    static const NodeKind KIND = NK_CHARACTER_CLASS;
+
     CharacterClass(const std::string& content, Node* parent);
+    CharacterClass(const CharSet& chars, Node* parent);
     CharacterClass(Parser& p, Node* parent);
 
     bool normalize();
@@ -27,6 +32,7 @@ public:
     bool is_single_char() const;
     bool is_negative() const;
 
+    CharSet get_charset() const;
     String convert_to_string() const;
     void merge(const CharacterClass& cc);
 
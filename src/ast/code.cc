@@ -3,8 +3,8 @@
 #include "utils.h"
 #include "log.h"
 
-Code::Code(const std::string& content, Node* parent) : Node("Code", parent), content(content) {}
-Code::Code(Parser& p, Node* parent) : Node("Code", parent) {
+Code::Code(const std::string& content, Node* parent) : Node(KIND, parent), content(content) {}
+Code::Code(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
 
@@ -30,7 +30,7 @@ void Code::parse(Parser& p) {
 }
 
 std::string Code::to_string(std::string indent) const {
-    std::string result = format_comments() + (comments.empty() ? "" : "\n");
+    std::string result = format_comments() + (has_comments() ? "\n" : "");
     if (!content.empty()) result += "%%\n";
     result += content;
     return result;
@@ -45,5 +45,5 @@ bool Code::is_multiline() const {
 }
 
 bool Code::empty() const {
-    return comments.empty() && content.empty();
+    return !has_comments() && content.empty();
 }
@@ -4,6 +4,8 @@
 class Code : public Node {
     std::string content;
 public:
+    static const NodeKind KIND = NK_CODE;
+
     Code(const std::string& content, Node* parent);
     Code(Parser& p, Node* parent);
 
@@ -2,8 +2,8 @@
 #include "utils.h"
 #include "log.h"
 
-Directive::Directive(const std::string& name, const std::string& value, bool code, Node* parent) : Node("Directive", parent), name(name), value(value), code(code) {}
-Directive::Directive(Parser& p, Node* parent) : Node("Directive", parent) {
+Directive::Directive(const std::string& name, const std::string& value, bool code, Node* parent) : Node(KIND, parent), name(name), value(value), code(code) {}
+Directive::Directive(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
 
@@ -11,6 +11,10 @@ bool Directive::is_import() const {
     return name == "import";
 }
 
+const std::string& Directive::get_name() const {
+    return name;
+}
+
 std::string Directive::get_value() const {
     return value;
 }
@@ -72,19 +76,19 @@ std::string Directive::to_string(std::string indent) const {
         result += value;
     }
     result += code ? "}"  : "\"";
-    if (!post_comment.empty()) {
-        result += " #" + post_comment;
+    if (has_post_comment()) {
+        result += " #" + get_post_comment();
     }
     return result;
 }
 
 std::string Directive::dump(std::string indent) const {
-    std::string comments_info = " (" + std::to_string(comments.size()) + " comments)";
+    std::string comments_info = " (" + std::to_string(get_comments().size()) + " comments)";
     std::string result = indent + "DIRECTIVE " + name + comments_info;
     result += (code ? " {": " \"" ) + to_c_string(value) + (code ? "}": "\"" );
     return result;
 }
 
 bool Directive::is_multiline() const {
-    return !comments.empty() || code;
+    return has_comments() || code;
 }
@@ -6,10 +6,13 @@ class Directive : public Node {
     std::string value;
     bool code;
 public:
+    static const NodeKind KIND = NK_DIRECTIVE;
+
     Directive(const std::string& name, const std::string& value, bool code, Node* parent);
     Directive(Parser& p, Node* parent);
 
     bool is_import() const;
+    const std::string& get_name() const;
     std::string get_value() const;
 
     virtual void parse(Parser& p);
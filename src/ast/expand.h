@@ -4,6 +4,8 @@
 class Expand : public Node {
     int content;
 public:
+    static const NodeKind KIND = NK_EXPAND;
+
     Expand(int content, Node* parent);
     Expand(Parser& p, Node* parent);
 
@@ -1,35 +1,195 @@
 #include "ast/grammar.h"
+#include "ast/visit.h"
 #include "utils.h"
 #include "log.h"
 
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <unistd.h>
+
 Grammar::Grammar(
     const std::vector<TopLevel>& nodes,
     const Code& code,
     const std::string& input_file
-) : Node("Grammar", nullptr), nodes(nodes), code(code), input_file(input_file) {}
+) : Node(KIND, nullptr), nodes(nodes), code(code), input_file(input_file) {}
 
 Grammar::Grammar(Parser& p, const std::string& input_file)
-    : Node("Grammar", nullptr), code("", this), input_file(input_file)
+    : Node(KIND, nullptr), code("", this), input_file(input_file)
 {
     parse(p);
 }
 
 Grammar::Grammar(const std::string& s, const std::string& input_file)
-    : Node("Grammar", nullptr), code("", this), input_file(input_file)
+    : Node(KIND, nullptr), code("", this), input_file(input_file)
 {
     Parser p(s);
     parse(p);
 }
 
+std::string Grammar::resolve_import(const Directive& d, const std::string& file) const {
+    std::string name = d.get_value();
+    return name.substr(0, 1) != "/"
+        ? find_file(name, Config::get_all_imports_dirs(file))
+        : name;
+}
+
+struct ImportedFile {
+    std::filesystem::file_time_type mtime;
+    std::vector<TopLevel> nodes;
+};
+
+// parsed imported files, shared by all grammars processed in this process, e.g. when many inputs import the same library
+static std::map<std::string, ImportedFile> import_cache;
+// if set, paths of newly parsed imports are also written to this file descriptor
+static int import_fd = -1;
+
+void Grammar::share_imports(int fd) {
+    import_fd = fd;
+}
+
+void Grammar::load_imports(int fd) {
+    std::string paths;
+    char buffer[4096];
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+        paths.append(buffer, count);
+    }
+    std::size_t start = 0;
+    for (std::size_t end = paths.find('\0'); end != std::string::npos; start = end + 1, end = paths.find('\0', start)) {
+        std::string path = paths.substr(start, end - start);
+        try {
+            load_import(path);
+        } catch (...) {
+            // the file changed or was removed since, it will be reported when it is imported again
+            import_cache.erase(path);
+        }
+    }
+}
+
+const std::vector<TopLevel>& Grammar::load_import(const std::string& path) {
+    std::string canonical = std::filesystem::weakly_canonical(path).native();
+    std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path);
+    std::map<std::string, ImportedFile>::iterator it = import_cache.find(canonical);
+    if (it != import_cache.end() && it->second.mtime == mtime) {
+        log(2, "Using already parsed file '%s'", path.c_str());
+        return it->second.nodes;
+    }
+    ImportedFile& file = import_cache[canonical];
+    file.mtime = mtime;
+    file.nodes.clear();
+    Parser p(read_file(path));
+    while (true) {
+        Rule r(p, nullptr);
+        if (r) {
+            file.nodes.push_back(r);
+            continue;
+        }
+        Directive d(p, nullptr);
+        if (!d) break;
+        file.nodes.push_back(d);
+    }
+    if (import_fd >= 0 && write(import_fd, canonical.c_str(), canonical.size() + 1) != (ssize_t)canonical.size() + 1) {
+        log(2, "Failed to share parsed import '%s'", path.c_str());
+    }
+    return file.nodes;
+}
+
+void Grammar::add_import(const std::string& path) {
+    if (std::find(imports.begin(), imports.end(), path) != imports.end()) {
+        return;
+    }
+    imports.push_back(path);
+    // imported files can import other files too
+    for (const TopLevel& node : load_import(path)) {
+        const Directive* d = std::get_if<Directive>(&node);
+        if (d && d->is_import()) {
+            std::string nested = resolve_import(*d, path);
+            if (!nested.empty()) {
+                add_import(nested);
+            }
+        }
+    }
+}
+
+void Grammar::follow_import(const std::string& path, std::set<std::string>& followed, std::set<std::string>& imported) {
+    // each file is imported only once, even if it is imported from multiple places
+    if (!followed.insert(std::filesystem::weakly_canonical(path).native()).second) {
+        return;
+    }
+    log(1, "Importing file '%s'...", path.c_str());
+    for (const TopLevel& node : load_import(path)) {
+        const Directive* d = std::get_if<Directive>(&node);
+        if (d && d->is_import()) {
+            std::string nested = resolve_import(*d, path);
+            if (nested.empty()) {
+                error("File '%s' not found", d->get_value().c_str());
+            }
+            follow_import(nested, followed, imported);
+            continue;
+        }
+        const Rule* r = std::get_if<Rule>(&node);
+        if (r) {
+            imported.insert(r->get_name());
+        }
+        nodes.push_back(node);
+    }
+    log(3, "Import done, returning to previous file.");
+}
+
+std::set<std::string> Grammar::reachable_rules() {
+    std::vector<Rule*> rules = find_all<Rule>();
+    if (rules.empty()) {
+        return {};
+    }
+    std::map<std::string, Rule*> by_name;
+    for (Rule* rule : rules) {
+        by_name[rule->get_name()] = rule;
+    }
+    // the first rule is the start rule
+    std::set<std::string> reachable = {rules[0]->get_name()};
+    std::vector<Rule*> stack = {rules[0]};
+    while (!stack.empty()) {
+        Rule* rule = stack.back();
+        stack.pop_back();
+        for (Reference* ref : rule->find_all<Reference>()) {
+            std::map<std::string, Rule*>::iterator it = by_name.find(ref->get_name());
+            if (it != by_name.end() && reachable.insert(ref->get_name()).second) {
+                stack.push_back(it->second);
+            }
+        }
+    }
+    return reachable;
+}
+
+void Grammar::remove_unused_imports(const std::set<std::string>& imported) {
+    // imported files are often libraries, only the rules reachable from the start rule are needed
+    std::vector<Rule*> rules = find_all<Rule>();
+    if (rules.empty() || imported.count(rules[0]->get_name())) {
+        return;
+    }
+    std::set<std::string> reachable = reachable_rules();
+    nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [&](const TopLevel& node) {
+        const Rule* r = std::get_if<Rule>(&node);
+        if (!r || !imported.count(r->get_name()) || reachable.count(r->get_name())) {
+            return false;
+        }
+        log(1, "Removing unused imported rule %s", r->c_str());
+        return true;
+    }), nodes.end());
+}
+
 void Grammar::parse(Parser& p) {
     debug("Parsing Grammar");
     DebugIndent _;
     debug("Parsing comments for node of type Grammar");
     while (p.match_comment()) {
-        comments.push_back(p.last_match);
-        debug("Comment: '%s'", comments.back().c_str());
+        add_comment(p.last_match);
+        debug("Comment: '%s'", p.last_match.c_str());
     }
 
+    std::set<std::string> followed;
+    std::set<std::string> imported;  // names of rules coming from imported files
     while (true) {
         Rule r(p, this);
         if (r) {
@@ -38,24 +198,17 @@ void Grammar::parse(Parser& p) {
         }
         Directive d(p, this);
         if (d) {
-            if (d.is_import() && !Config::get<bool>("no-follow") && Config::get(O_ALL)) {
-                std::string name = d.get_value();
-                std::string path = name.substr(0, 1) != "/"
-                    ? find_file(name, Config::get_all_imports_dirs(input_file))
-                    : name;
+            bool follow = d.is_import() && !Config::get<bool>("no-follow") && Config::get(O_ALL);
+            bool track = d.is_import() && !Config::get<std::string>("depfile").empty();
+            std::string path = (follow || track) ? resolve_import(d, input_file) : "";
+            if (track && !path.empty()) {
+                add_import(path);
+            }
+            if (follow) {
                 if (path.empty()) {
                     error("File '%s' not found", d.get_value().c_str());
                 }
-                log(1, "Importing file '%s'...", path.c_str());
-                Parser parser(read_file(path));
-                do {
-                    Rule r(parser, this);
-                    if (r) {
-                        nodes.push_back(r);
-                        continue;
-                    }
-                } while (false);
-                log(3, "Import done, returning to previous file.");
+                follow_import(path, followed, imported);
             } else {
                 nodes.push_back(d);
             }
@@ -69,6 +222,10 @@ void Grammar::parse(Parser& p) {
         error("Failed to parse grammar!");
     }
     update_parents();
+    if (!imported.empty()) {
+        remove_unused_imports(imported);
+        update_parents();
+    }
     valid = true;
 }
 
@@ -119,8 +276,8 @@ std::string Grammar::to_string(std::string indent) const {
 
 std::string Grammar::dump(std::string indent) const {
     std::string result = indent + "GRAMMAR";
-    if (!comments.empty()) {
-        result += " (" + std::to_string(comments.size()) + " comments)";
+    if (has_comments()) {
+        result += " (" + std::to_string(get_comments().size()) + " comments)";
     }
     result += "\n";
     for (const TopLevel& node : nodes) {
@@ -153,9 +310,31 @@ long Grammar::size() const {
     return nodes.size();
 }
 
+const std::vector<std::string>& Grammar::get_imports() const {
+    return imports;
+}
+
 void Grammar::erase(Rule* rule) {
     std::vector<TopLevel>::iterator it = std::find_if(nodes.begin(), nodes.end(), [rule](const TopLevel& n) {
         return std::get_if<Rule>(&n) == rule;
     });
     nodes.erase(it);
 }
+
+void Grammar::reorder(const std::vector<std::string>& order) {
+    std::map<std::string, Rule> rules;
+    std::vector<TopLevel*> slots;
+    for (TopLevel& n : nodes) {
+        if (Rule* rule = std::get_if<Rule>(&n)) {
+            rules.emplace(rule->get_name(), std::move(*rule));
+            slots.push_back(&n);
+        }
+    }
+    if (order.size() != slots.size()) {
+        error("rule order must contain each rule exactly once!");
+    }
+    for (int i = 0; i < slots.size(); i++) {
+        *slots[i] = std::move(rules.at(order[i]));
+    }
+    update_parents();
+}
@@ -5,13 +5,27 @@
 #include "ast/rule.h"
 #include "ast/code.h"
 
+#include <set>
+
 using TopLevel = std::variant<std::monostate, Directive, Rule>;
 
 class Grammar : public Node {
     std::vector<TopLevel> nodes;
     Code code;
     std::string input_file;
+    std::vector<std::string> imports;
+
+    std::string resolve_import(const Directive& d, const std::string& file) const;
+    void add_import(const std::string& path);
+    void follow_import(const std::string& path, std::set<std::string>& followed, std::set<std::string>& imported);
+    void remove_unused_imports(const std::set<std::string>& imported);
+    static const std::vector<TopLevel>& load_import(const std::string& path);
 public:
+    static const NodeKind KIND = NK_GRAMMAR;
+
+    static void share_imports(int fd);
+    static void load_imports(int fd);
+
     Grammar(
         const std::vector<TopLevel>& nodes,
         const Code& code,
@@ -29,4 +43,7 @@ public:
     virtual long size() const;
 
     void erase(Rule* rule);
+    void reorder(const std::vector<std::string>& order);  // rules are placed in given order, directives stay in place
+    std::set<std::string> reachable_rules();
+    const std::vector<std::string>& get_imports() const;
 };
@@ -2,11 +2,20 @@
 #include "ast/alternation.h"
 #include "log.h"
 
-Group::Group(const Alternation& expression, Node* parent) : Node("Group", parent), expression(new Alternation(expression)) {}
-Group::Group(Parser& p, Node* parent) : Node("Group", parent) {
+Group::Group(const Alternation& expression, Node* parent) : Node(KIND, parent), expression(new Alternation(expression)) {}
+Group::Group(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
 
+// the expression is copied too, so that the copies can be modified independently
+Group::Group(const Group& other) : Node(other), expression(other.expression ? new Alternation(*other.expression) : nullptr) {}
+
+Group& Group::operator=(const Group& other) {
+    Node::operator=(other);
+    expression.reset(other.expression ? new Alternation(*other.expression) : nullptr);
+    return *this;
+}
+
 void Group::parse(Parser& p) {
     debug("Parsing Group");
     DebugIndent _;
@@ -38,8 +47,8 @@ std::string Group::to_string(std::string indent) const {
     } else {
         result = "(" + expression->to_string(indent) + ")";
     }
-    if (!post_comment.empty()) {
-        result += " #" + post_comment;
+    if (has_post_comment()) {
+        result += " #" + get_post_comment();
     }
     return result;
 }
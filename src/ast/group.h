@@ -8,8 +8,12 @@ class Term;
 class Group : public Node {
     std::shared_ptr<Alternation> expression;
 public:
+    static const NodeKind KIND = NK_GROUP;
+
     Group(const Alternation& expression, Node* parent);
     Group(Parser& p, Node* parent);
+    Group(const Group& other);
+    Group& operator=(const Group& other);
 
     virtual void parse(Parser& p);
     virtual std::string to_string(std::string indent = "") const override;
@@ -19,6 +23,7 @@ public:
     virtual Node* operator[](int index);
     virtual long size() const;
 
+    Alternation& get_expression() { return *expression; }
     bool has_single_sequence() const;
     bool has_single_term() const;
     const Sequence& get_first_sequence() const;
@@ -2,8 +2,92 @@
 #include "ast/grammar.h"
 #include "log.h"
 
-Node::Node(const char* type, Node* parent) : valid(false), parent(parent), type(type) {
-    debug("Creating %s @%p, parent: %p", type, this, parent);
+#include <mutex>
+#include <unordered_map>
+
+static const char* const NODE_TYPES[] = {
+    "Action", "Alternation", "Capture", "CharacterClass", "Code", "Directive", "Expand",
+    "Grammar", "Group", "Reference", "Rule", "Sequence", "String", "Term"
+};
+
+struct NodeComments {
+    std::vector<std::string> comments;
+    std::string post_comment;
+};
+
+// Comments of all nodes, keyed by Node::comments_id. Nodes are copied and destroyed from multiple
+// threads during optimization, so all access is guarded by the mutex.
+class CommentTable {
+    std::unordered_map<unsigned int, NodeComments> table;
+    unsigned int last_id = 0;
+    std::mutex mutex;
+public:
+    static CommentTable& instance() {
+        // never destroyed, so that it outlives nodes with static storage (e.g. cached imports)
+        static CommentTable* instance = new CommentTable();
+        return *instance;
+    }
+
+    unsigned int create() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (++last_id == 0) last_id++;
+        table[last_id];
+        return last_id;
+    }
+
+    unsigned int copy(unsigned int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (++last_id == 0) last_id++;
+        table[last_id] = table.at(id);
+        return last_id;
+    }
+
+    NodeComments& get(unsigned int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return table.at(id);
+    }
+
+    void remove(unsigned int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        table.erase(id);
+    }
+};
+
+static const NodeComments NO_COMMENTS;
+
+Node::Node(NodeKind kind, Node* parent) : comments_id(0), parent(parent), kind(kind), valid(false) {
+    debug("Creating %s @%p, parent: %p", get_type(), this, parent);
+}
+
+Node::Node(const Node& other) : comments_id(0), parent(other.parent), kind(other.kind), valid(other.valid) {
+    if (other.comments_id) {
+        comments_id = CommentTable::instance().copy(other.comments_id);
+    }
+}
+
+Node& Node::operator=(const Node& other) {
+    if (this == &other) return *this;
+    if (comments_id) {
+        CommentTable::instance().remove(comments_id);
+        comments_id = 0;
+    }
+    if (other.comments_id) {
+        comments_id = CommentTable::instance().copy(other.comments_id);
+    }
+    parent = other.parent;
+    kind = other.kind;
+    valid = other.valid;
+    return *this;
+}
+
+Node::~Node() {
+    if (comments_id) {
+        CommentTable::instance().remove(comments_id);
+    }
+}
+
+const char* Node::get_type() const {
+    return NODE_TYPES[kind];
 }
 
 Node::operator bool() const {
@@ -19,7 +103,7 @@ long Node::size() const {
 }
 
 void Node::parse_comments(Parser& p, bool store) {
-    debug("Parsing comments for node of type %s", type);
+    debug("Parsing comments for node of type %s", get_type());
     p.skip_space();
     while (p.match_comment()) {
         if (store) {
@@ -27,7 +111,7 @@ void Node::parse_comments(Parser& p, bool store) {
             if (!comment.empty() && comment.back() == '\n') {
                 comment.pop_back();
             }
-            comments.push_back(comment);
+            add_comment(comment);
             debug("Comment: '%s'", comment.c_str());
         }
         if (p.peek_re("(\\s*\\n)+\\s*\\#", false)) {
@@ -36,21 +120,22 @@ void Node::parse_comments(Parser& p, bool store) {
             p.skip_space();
             if (store) {
                 debug("Detected empty line(s) between comments\n");
-                comments.push_back("");
+                add_comment("");
             }
         }
     }
 }
 
 void Node::parse_post_comment(Parser& p) {
-    debug("Parsing post-comment for node of type %s", type);
+    debug("Parsing post-comment for node of type %s", get_type());
     if (p.match_re("[ \t]*#([^\\n]*)", false)) {
-        post_comment = p.last_re_match.str(1);
-        debug("Post-comment: '%s'", post_comment.c_str());
+        set_post_comment(p.last_re_match.str(1));
+        debug("Post-comment: '%s'", get_post_comment().c_str());
     }
 }
 
 std::string Node::format_comments(std::string indent) const {
+    const std::vector<std::string>& comments = get_comments();
     if (comments.empty()) return "";
     std::string result;
     for(int i = 0; i < comments.size(); i++) {
@@ -60,28 +145,20 @@ std::string Node::format_comments(std::string indent) const {
 }
 
 std::string Node::dump_comments() const {
-    if (comments.empty() && post_comment.empty()) {
+    if (!has_comments() && !has_post_comment()) {
         return "";
     }
+    const std::vector<std::string>& comments = get_comments();
     std::string result = "";
     if (!comments.empty()) {
         result += std::to_string(comments.size()) + " comment" + (comments.size() > 1 ? "s" : "");
     }
-    if (!post_comment.empty()) {
+    if (has_post_comment()) {
         result += result.empty() ? "post-comment" : ", post-comment";
     }
     return " (" + result + ")";
 }
 
-bool Node::map(const std::function<bool(Node&)>& transform) {
-    if (transform(*this)) return true;
-    for (int i = 0; i < size(); i++) {
-        Node* n = (*this)[i];
-        if (n->map(transform)) return true;
-    }
-    return false;
-}
-
 bool Node::is_descendant_of(Node* n) const {
     if (!parent) return false;
     if (parent == n) return true;
@@ -91,25 +168,49 @@ bool Node::is_descendant_of(Node* n) const {
 void Node::update_parents() {
     for (int i = 0; i < size(); i++) {
         Node* n = (*this)[i];
-        //~ debug("Updating parent of %s@%p, parent: %p -> %p%s", n->type, n, n->parent, this, n->parent == this ? " (NO CHANGE)" : "");
+        //~ debug("Updating parent of %s@%p, parent: %p -> %p%s", n->get_type(), n, n->parent, this, n->parent == this ? " (NO CHANGE)" : "");
         n->parent = this;
         n->update_parents();
     }
 }
 
 bool Node::has_comments() const {
-    return !comments.empty();
+    return !get_comments().empty();
 }
 
 bool Node::has_post_comment() const {
-    return !post_comment.empty();
+    return !get_post_comment().empty();
+}
+
+const std::vector<std::string>& Node::get_comments() const {
+    if (!comments_id) return NO_COMMENTS.comments;
+    return CommentTable::instance().get(comments_id).comments;
+}
+
+const std::string& Node::get_post_comment() const {
+    if (!comments_id) return NO_COMMENTS.post_comment;
+    return CommentTable::instance().get(comments_id).post_comment;
+}
+
+void Node::add_comment(const std::string& comment) {
+    if (!comments_id) {
+        comments_id = CommentTable::instance().create();
+    }
+    CommentTable::instance().get(comments_id).comments.push_back(comment);
+}
+
+void Node::set_post_comment(const std::string& comment) {
+    if (!comments_id) {
+        comments_id = CommentTable::instance().create();
+    }
+    CommentTable::instance().get(comments_id).post_comment = comment;
 }
 
 
 #define CMP(TYPE) if (a.is<TYPE>()) { return *(TYPE*)(&a) == *(TYPE*)(&b); }
 
 bool operator==(const Node& a, const Node& b) {
-    if (a.type != b.type) return false;
+    if (a.kind != b.kind) return false;
     CMP(Action);
     CMP(Alternation);
     CMP(Capture);
@@ -6,15 +6,44 @@
 
 #include "parser.h"
 
+// Type of the node, checked instead of RTTI, because it is needed in every traversal
+enum NodeKind : unsigned char {
+    NK_ACTION,
+    NK_ALTERNATION,
+    NK_CAPTURE,
+    NK_CHARACTER_CLASS,
+    NK_CODE,
+    NK_DIRECTIVE,
+    NK_EXPAND,
+    NK_GRAMMAR,
+    NK_GROUP,
+    NK_REFERENCE,
+    NK_RULE,
+    NK_SEQUENCE,
+    NK_STRING,
+    NK_TERM
+};
+
+// Predicate accepting all nodes, default for find_all
+struct AnyNode {
+    template<class U>
+    bool operator()(const U&) const { return true; }
+};
+
 class Node {
+    // comments are rare, so they are kept in a side table (see node.cc), 0 means the node has none
+    unsigned int comments_id;
+
 public:
-    bool valid;
     Node* parent;
-    Node(const char* type, Node* parent);
+    NodeKind kind;
+    bool valid;
+    Node(NodeKind kind, Node* parent);
+    Node(const Node& other);
+    Node& operator=(const Node& other);
+    virtual ~Node();
 
-    const char* type;
-    std::vector<std::string> comments;
-    std::string post_comment;
+    const char* get_type() const;
 
     virtual void parse(Parser& p) = 0;
     virtual std::string to_string(std::string indent = "") const = 0;
@@ -43,13 +72,15 @@ public:
 
     void update_parents();
 
-    template <class U>
-    std::vector<U*> find_all(const std::function<bool(const U&)>& predicate=[] (const U & node)->bool { return true; });
+    // traversals are defined in ast/visit.h
+    template <class U, class Predicate = AnyNode>
+    std::vector<U*> find_all(const Predicate& predicate = Predicate());
 
-    template <class U>
-    void find_all(std::vector<U*>& result, const std::function<bool(const U&)>& predicate);
+    template <class U, class Predicate>
+    void find_all(std::vector<U*>& result, const Predicate& predicate);
 
-    bool map(const std::function<bool(Node&)>& transform);
+    template <class Transform>
+    bool map(const Transform& transform);
 
     void parse_comments(Parser& p, bool store = true);
     void parse_post_comment(Parser& p);
@@ -58,13 +89,17 @@ public:
 
     bool has_comments() const;
     bool has_post_comment() const;
+    const std::vector<std::string>& get_comments() const;
+    const std::string& get_post_comment() const;
+    void add_comment(const std::string& comment);
+    void set_post_comment(const std::string& comment);
 
     friend bool operator==(const Node& a, const Node& b);
 };
 
 template<class U>
 bool Node::is() const {
-    return typeid(*this) == typeid(U);
+    return kind == U::KIND;
 }
 
 template<class U>
@@ -89,24 +124,6 @@ U* Node::get_ancestor() const {
     }
 }
 
-template <class U>
-std::vector<U*> Node::find_all(const std::function<bool(const U&)>& predicate) {
-    std::vector<U*> result;
-    find_all(result, predicate);
-    return result;
-}
-
-template <class U>
-void Node::find_all(std::vector<U*>& result, const std::function<bool(const U&)>& predicate) {
-    if (is<U>() && predicate(*(U*)this)) {
-        result.push_back((U*)(this));
-    }
-    for (int i = 0; i < size(); i++) {
-        Node* n = (*this)[i];
-        n->find_all(result, predicate);
-    }
-}
-
 bool operator==(const Node& a, const Node& b);
 bool operator!=(const Node& a, const Node& b);
 
@@ -2,8 +2,8 @@
 #include "ast/rule.h"
 #include "log.h"
 
-Reference::Reference(const std::string& name, const std::string& var, Node* parent) : Node("Reference", parent), name(name), var(var) {}
-Reference::Reference(Parser& p, Node* parent) : Node("Reference", parent) {
+Reference::Reference(const std::string& name, const std::string& var, Node* parent) : Node(KIND, parent), name(name), var(var) {}
+Reference::Reference(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
 
@@ -48,6 +48,14 @@ bool Reference::is_multiline() const {
     return false;
 }
 
+const std::string& Reference::get_name() const {
+    return name;
+}
+
+const std::string& Reference::get_variable() const {
+    return var;
+}
+
 bool Reference::references(const Rule* rule) const {
     return name == rule->name;
 }
@@ -60,6 +68,10 @@ void Reference::remove_variable() {
     return var.clear();
 }
 
+void Reference::rename(const std::string& new_name) {
+    name = new_name;
+}
+
 bool operator==(const Reference& a, const Reference& b) {
     return a.name == b.name && a.var == b.var;
 }
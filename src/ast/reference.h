@@ -8,6 +8,8 @@ class Reference : public Node {
     std::string name;
     std::string var;
 public:
+    static const NodeKind KIND = NK_REFERENCE;
+
     Reference(const std::string& name, const std::string& var, Node* parent);
     Reference(Parser& p, Node* parent);
 
@@ -16,9 +18,12 @@ public:
     virtual std::string dump(std::string indent = "") const override;
     virtual bool is_multiline() const override;
 
+    const std::string& get_name() const;
+    const std::string& get_variable() const;
     bool references(const Rule* rule) const;
     bool has_variable() const;
     void remove_variable();
+    void rename(const std::string& new_name);
 
     friend bool operator==(const Reference& a, const Reference& b);
     friend class Action;
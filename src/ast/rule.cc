@@ -1,9 +1,11 @@
 #include "ast/rule.h"
+#include "ast/visit.h"
 #include "config.h"
+#include "analysis.h"
 #include "log.h"
 
-Rule::Rule(const std::string& name, const Alternation& expression, Node* parent) : Node("Rule", parent), name(name), expression(expression) {}
-Rule::Rule(Parser& p, Node* parent) : Node("Rule", parent), expression(this) {
+Rule::Rule(const std::string& name, const Alternation& expression, Node* parent) : Node(KIND, parent), name(name), expression(expression) {}
+Rule::Rule(Parser& p, Node* parent) : Node(KIND, parent), expression(this) {
     parse(p);
 }
 
@@ -27,7 +29,7 @@ void Rule::parse(Parser& p) {
 }
 
 std::string Rule::to_string(std::string indent) const {
-    std::string result = format_comments() + (comments.empty() ? "" : "\n") + name + " <-";
+    std::string result = format_comments() + (has_comments() ? "\n" : "") + name + " <-";
     if (is_multiline()) {
         result += "\n" + expression.to_string("    ");
     } else {
@@ -37,7 +39,7 @@ std::string Rule::to_string(std::string indent) const {
 }
 
 std::string Rule::dump(std::string indent) const {
-    return indent + "RULE " + name + dump_comments() + "\n" + expression.dump(indent + "  ");
+    return indent + "RULE " + name + dump_comments() + Analysis::annotate(*this) + "\n" + expression.dump(indent + "  ");
 }
 
 bool Rule::is_multiline() const {
@@ -63,6 +65,10 @@ const char* Rule::c_str() const {
     return name.c_str();
 }
 
+const std::string& Rule::get_name() const {
+    return name;
+}
+
 bool Rule::is_terminal() const {
     if (expression.size() != 1) return false;
     if (expression.get_first_sequence().size() != 1) return false;
@@ -83,19 +89,6 @@ bool Rule::contains_expand() {
     return find_all<Expand>().size() > 0;
 }
 
-int Rule::count_terms() {
-    return find_all<Term>().size();
-}
-
-int Rule::count_cc_tokens() {
-    std::vector<CharacterClass*> ccs = find_all<CharacterClass>([](const CharacterClass& cc) -> bool {
-        return !cc.any_char();
-    });
-    int count = 0;
-    for (CharacterClass* cc: ccs) count += cc->token_count();
-    return count;
-}
-
 void Rule::update_captures() {
     std::vector<Capture*> captures = find_all<Capture>();
     for (int i = 0; i < captures.size(); i++) {
@@ -8,6 +8,8 @@ class Rule : public Node {
     std::string name;
     Alternation expression;
 public:
+    static const NodeKind KIND = NK_RULE;
+
     Rule(const std::string& name, const Alternation& expression, Node* parent);
     Rule(Parser& p, Node* parent);
 
@@ -20,13 +22,13 @@ public:
     virtual long size() const;
 
     const char* c_str() const;
+    Alternation& get_expression() { return expression; }
+    const std::string& get_name() const;
     bool is_terminal() const;
     Group convert_to_group() const;
 
     bool contains_alternation();
     bool contains_expand();
-    int count_terms();
-    int count_cc_tokens();
     void update_captures();
 
     friend class Reference;
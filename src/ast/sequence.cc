@@ -1,8 +1,9 @@
 #include "ast/sequence.h"
+#include "analysis.h"
 #include "log.h"
 
-Sequence::Sequence(const std::vector<Term>& terms, Node* parent) : Node("Sequence", parent), terms(terms) {}
-Sequence::Sequence(Parser& p, Node* parent) : Node("Sequence", parent) {
+Sequence::Sequence(const std::vector<Term>& terms, Node* parent) : Node(KIND, parent), terms(terms) {}
+Sequence::Sequence(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
 
@@ -48,7 +49,7 @@ std::string Sequence::to_string(std::string indent) const {
 }
 
 std::string Sequence::dump(std::string indent) const {
-    std::string result = indent + "SEQ\n";
+    std::string result = indent + "SEQ" + Analysis::annotate(*this) + "\n";
     for (int i = 0; i < terms.size(); i++) {
         if (i > 0) result += "\n";
         result += terms[i].dump(indent + "  ");
@@ -5,6 +5,8 @@
 class Sequence : public Node {
     std::vector<Term> terms;
 public:
+    static const NodeKind KIND = NK_SEQUENCE;
+
     Sequence(const std::vector<Term>& terms, Node* parent);
     Sequence(Parser& p, Node* parent);
 
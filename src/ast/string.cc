@@ -3,8 +3,8 @@
 #include "config.h"
 #include "log.h"
 
-String::String(const std::string& content, Node* parent) : Node("String", parent), content(content) {}
-String::String(Parser& p, Node* parent) : Node("String", parent) {
+String::String(const std::string& content, Node* parent) : Node(KIND, parent), content(content) {}
+String::String(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
 
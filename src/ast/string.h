@@ -4,6 +4,8 @@
 class String : public Node {
     std::string content;
 public:
+    static const NodeKind KIND = NK_STRING;
+
     String(const std::string& content, Node* parent);
     String(Parser& p, Node* parent);
 
@@ -1,8 +1,8 @@
 #include "ast/term.h"
 #include "log.h"
 
-Term::Term(char prefix, char quantifier, const Primary& primary, Node* parent) : Node("Term", parent), prefix(prefix), quantifier(quantifier), primary(primary) {}
-Term::Term(Parser& p, Node* parent) : Node("Term", parent) {
+Term::Term(char prefix, char quantifier, const Primary& primary, Node* parent) : Node(KIND, parent), prefix(prefix), quantifier(quantifier), primary(primary) {}
+Term::Term(Parser& p, Node* parent) : Node(KIND, parent) {
     parse(p);
 }
 
@@ -77,14 +77,14 @@ std::string Term::dump(const Primary& x, std::string indent) const {
 
 std::string Term::to_string(std::string indent) const {
     std::string result;
-    if (comments.size()) {
+    if (has_comments()) {
         result += "\n" + format_comments(indent) + "\n" + indent;
     }
     if (prefix != 0) result += std::string(1, prefix);
     result += to_string(primary, indent);
     if (quantifier != 0) result += std::string(1, quantifier);
-    if (!post_comment.empty()) {
-        result += " #" + post_comment;
+    if (has_post_comment()) {
+        result += " #" + get_post_comment();
     }
     return result;
 }
@@ -98,31 +98,31 @@ std::string Term::dump(std::string indent) const {
 }
 
 bool Term::is_multiline() const {
-    if (!comments.empty()) return true;
-    if (!post_comment.empty()) return true;
-    if (std::get_if<1>(&primary)) return (Node*)(std::get_if<1>(&primary))->is_multiline();
-    if (std::get_if<2>(&primary)) return (Node*)(std::get_if<2>(&primary))->is_multiline();
-    if (std::get_if<3>(&primary)) return (Node*)(std::get_if<3>(&primary))->is_multiline();
-    if (std::get_if<4>(&primary)) return (Node*)(std::get_if<4>(&primary))->is_multiline();
-    if (std::get_if<5>(&primary)) return (Node*)(std::get_if<5>(&primary))->is_multiline();
-    if (std::get_if<6>(&primary)) return (Node*)(std::get_if<6>(&primary))->is_multiline();
-    if (std::get_if<7>(&primary)) return (Node*)(std::get_if<7>(&primary))->is_multiline();
-    error("unsupported type!");
+    if (has_comments()) return true;
+    if (has_post_comment()) return true;
+    if (primary.index() == 0) error("unsupported type!");
+    return std::visit([](const auto& content) -> bool {
+        if constexpr (std::is_same_v<std::decay_t<decltype(content)>, std::monostate>) {
+            return false;
+        } else {
+            return content.is_multiline();
+        }
+    }, primary);
 }
 
 Node* Term::operator[](int index) {
-    if (index == 0) {
-        if (std::get_if<1>(&primary)) return (Node*)(std::get_if<1>(&primary));
-        if (std::get_if<2>(&primary)) return (Node*)(std::get_if<2>(&primary));
-        if (std::get_if<3>(&primary)) return (Node*)(std::get_if<3>(&primary));
-        if (std::get_if<4>(&primary)) return (Node*)(std::get_if<4>(&primary));
-        if (std::get_if<5>(&primary)) return (Node*)(std::get_if<5>(&primary));
-        if (std::get_if<6>(&primary)) return (Node*)(std::get_if<6>(&primary));
-        if (std::get_if<7>(&primary)) return (Node*)(std::get_if<7>(&primary));
-        error("unsupported type!");
-    } else {
+    if (index != 0) {
         error("index out of bounds!");
     }
+    Node* result = nullptr;
+    visit_content([&result](Node& content) {
+        result = &content;
+        return true;
+    });
+    if (!result) {
+        error("unsupported type!");
+    }
+    return result;
 }
 
 long Term::size() const {
@@ -168,6 +168,14 @@ void Term::set_content(Primary content) {
     primary = content;
 }
 
+char Term::get_prefix() const {
+    return prefix;
+}
+
+char Term::get_quantifier() const {
+    return quantifier;
+}
+
 bool Term::same_prefix(const Term& t) {
     return prefix == t.prefix;
 }
@@ -176,6 +184,10 @@ bool Term::same_quantifier(const Term& t) {
     return quantifier == t.quantifier;
 }
 
+bool Term::same_content(const Term& t) const {
+    return primary == t.primary;
+}
+
 void Term::copy_prefix(const Term& other) {
     prefix = other.prefix;
 }
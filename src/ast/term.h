@@ -1,4 +1,5 @@
 #pragma once
+#include <type_traits>
 #include <variant>
 
 #include "ast/node.h"
@@ -17,6 +18,8 @@ class Term : public Node {
     char quantifier;
     Primary primary;
 public:
+    static const NodeKind KIND = NK_TERM;
+
     Term(char prefix, char quantifier, const Primary& primary, Node* parent);
     Term(Parser& p, Node* parent);
 
@@ -40,6 +43,13 @@ public:
     template<class T>
     T& get();
 
+    template<class T>
+    const T& get() const;
+
+    // calls f with the content of the term
+    template<class F>
+    bool visit_content(const F& f);
+
     bool is_quantified() const;
     bool is_prefixed() const;
     bool is_greedy() const;
@@ -47,8 +57,11 @@ public:
     bool is_simple() const;
     bool is_negative() const;
 
+    char get_prefix() const;
+    char get_quantifier() const;
     bool same_prefix(const Term& t);
     bool same_quantifier(const Term& t);
+    bool same_content(const Term& t) const;
 
     void flip_negation();
     void set_prefix(int new_prefix);
@@ -59,8 +72,6 @@ public:
     void copy_content(const Term& other);
 
     friend bool operator==(const Term& a, const Term& b);
-    friend int optimize_repeating_terms(Term& t1, Term& t2);
-    friend int optimize_double_quantifiers(const Term& outer, const Term& inner);
 };
 
 bool operator==(const Term& a, const Term& b);
@@ -75,3 +86,19 @@ template<class T>
 T& Term::get() {
     return std::get<T>(primary);
 }
+
+template<class T>
+const T& Term::get() const {
+    return std::get<T>(primary);
+}
+
+template<class F>
+bool Term::visit_content(const F& f) {
+    return std::visit([&f](auto& content) -> bool {
+        if constexpr (std::is_same_v<std::decay_t<decltype(content)>, std::monostate>) {
+            return false;
+        } else {
+            return f(content);
+        }
+    }, primary);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "ast/grammar.h"
+
+// Calls f for each child of the node, stops when f returns true. The children are
+// dispatched by kind of the node, so the callback can be inlined and no virtual call is needed.
+template <class F>
+bool visit_children(Node& node, const F& f) {
+    switch (node.kind) {
+    case NK_ALTERNATION: {
+        Alternation& a = static_cast<Alternation&>(node);
+        for (long i = 0; i < a.Alternation::size(); i++) {
+            if (f(a.get(i))) return true;
+        }
+        return false;
+    }
+    case NK_SEQUENCE: {
+        Sequence& s = static_cast<Sequence&>(node);
+        for (long i = 0; i < s.Sequence::size(); i++) {
+            if (f(s.get(i))) return true;
+        }
+        return false;
+    }
+    case NK_TERM:
+        return static_cast<Term&>(node).visit_content(f);
+    case NK_RULE:
+        return f(static_cast<Rule&>(node).get_expression());
+    case NK_GROUP:
+        return f(static_cast<Group&>(node).get_expression());
+    case NK_CAPTURE:
+        return f(static_cast<Capture&>(node).get_expression());
+    case NK_GRAMMAR: {
+        Grammar& g = static_cast<Grammar&>(node);
+        for (long i = 0; i < g.Grammar::size(); i++) {
+            if (f(*g.Grammar::operator[](i))) return true;
+        }
+        return false;
+    }
+    default:
+        return false;
+    }
+}
+
+template <class U, class Predicate>
+std::vector<U*> Node::find_all(const Predicate& predicate) {
+    std::vector<U*> result;
+    find_all(result, predicate);
+    return result;
+}
+
+template <class U, class Predicate>
+void Node::find_all(std::vector<U*>& result, const Predicate& predicate) {
+    if (is<U>() && predicate(*(U*)this)) {
+        result.push_back((U*)(this));
+    }
+    // rules and directives are only found at the top level
+    if ((U::KIND == NK_RULE || U::KIND == NK_DIRECTIVE) && kind == NK_RULE) {
+        return;
+    }
+    visit_children(*this, [&result, &predicate](Node& child) {
+        child.find_all(result, predicate);
+        return false;
+    });
+}
+
+template <class Transform>
+bool Node::map(const Transform& transform) {
+    if (transform(*this)) return true;
+    return visit_children(*this, [&transform](Node& child) {
+        return child.map(transform);
+    });
+}
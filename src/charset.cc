@@ -0,0 +1,241 @@
+#include "charset.h"
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+CharSet::CharSet() {}
+
+CharSet::CharSet(int c) {
+    add(c, c);
+}
+
+CharSet::CharSet(int first, int last) {
+    add(first, last);
+}
+
+CharSet::CharSet(const Ranges& ranges) {
+    for (const Range& r : ranges) {
+        add(r.first, r.second);
+    }
+}
+
+CharSet CharSet::any() {
+    return CharSet(0, MAX);
+}
+
+void CharSet::add(int first, int last) {
+    first = std::max(first, 0);
+    last = std::min(last, MAX);
+    if (first > last) return;
+    if (first < BITMAP_SIZE) {
+        int end = std::min(last, BITMAP_SIZE - 1);
+        std::bitset<BITMAP_SIZE> mask;
+        mask.set();
+        mask >>= BITMAP_SIZE - 1 - (end - first);
+        mask <<= first;
+        low |= mask;
+    }
+    if (last >= BITMAP_SIZE) {
+        add_high(std::max(first, BITMAP_SIZE), last);
+    }
+}
+
+void CharSet::add_high(int first, int last) {
+    // keep the ranges sorted and coalesced, so that equal sets have equal representation
+    Ranges::iterator it = std::lower_bound(high.begin(), high.end(), Range(first, first));
+    if (it != high.begin() && (it - 1)->second + 1 >= first) {
+        it--;
+        first = it->first;
+    }
+    Ranges::iterator end = it;
+    while (end != high.end() && end->first <= last + 1) {
+        last = std::max(last, end->second);
+        end++;
+    }
+    it = high.erase(it, end);
+    high.insert(it, Range(first, last));
+}
+
+CharSet::Ranges CharSet::intersect(const Ranges& a, const Ranges& b) {
+    Ranges result;
+    Ranges::const_iterator i = a.begin();
+    Ranges::const_iterator j = b.begin();
+    while (i != a.end() && j != b.end()) {
+        int first = std::max(i->first, j->first);
+        int last = std::min(i->second, j->second);
+        if (first <= last) {
+            result.push_back(Range(first, last));
+        }
+        if (i->second < j->second) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+    return result;
+}
+
+CharSet CharSet::complement() const {
+    CharSet result;
+    result.low = ~low;
+    int next = BITMAP_SIZE;
+    for (const Range& r : high) {
+        if (r.first > next) {
+            result.high.push_back(Range(next, r.first - 1));
+        }
+        next = r.second + 1;
+    }
+    if (next <= MAX) {
+        result.high.push_back(Range(next, MAX));
+    }
+    return result;
+}
+
+bool CharSet::empty() const {
+    return low.none() && high.empty();
+}
+
+bool CharSet::is_any() const {
+    return low.all() && high.size() == 1 && high[0].first == BITMAP_SIZE && high[0].second == MAX;
+}
+
+bool CharSet::contains(int c) const {
+    if (c < BITMAP_SIZE) {
+        return c >= 0 && low.test(c);
+    }
+    Ranges::const_iterator it = std::upper_bound(high.begin(), high.end(), Range(c, MAX));
+    return it != high.begin() && (it - 1)->second >= c;
+}
+
+bool CharSet::intersects(const CharSet& other) const {
+    return (low & other.low).any() || !intersect(high, other.high).empty();
+}
+
+bool CharSet::is_subset_of(const CharSet& other) const {
+    return (low & ~other.low).none() && intersect(high, other.high) == high;
+}
+
+int CharSet::min() const {
+    for (int c = 0; c < BITMAP_SIZE; c++) {
+        if (low.test(c)) return c;
+    }
+    return high.empty() ? -1 : high.front().first;
+}
+
+int CharSet::max() const {
+    if (!high.empty()) {
+        return high.back().second;
+    }
+    for (int c = BITMAP_SIZE - 1; c >= 0; c--) {
+        if (low.test(c)) return c;
+    }
+    return -1;
+}
+
+CharSet::Ranges CharSet::ranges() const {
+    Ranges result;
+    for (int c = 0; c < BITMAP_SIZE; c++) {
+        if (!low.test(c)) continue;
+        int first = c;
+        while (c + 1 < BITMAP_SIZE && low.test(c + 1)) c++;
+        result.push_back(Range(first, c));
+    }
+    for (const Range& r : high) {
+        if (!result.empty() && result.back().second + 1 == r.first) {
+            result.back().second = r.second;
+        } else {
+            result.push_back(r);
+        }
+    }
+    return result;
+}
+
+CharSet& CharSet::operator|=(const CharSet& other) {
+    low |= other.low;
+    if (other.high.empty()) {
+        return *this;
+    }
+    // both lists are sorted and coalesced, so they can be merged in linear time
+    Ranges merged;
+    merged.reserve(high.size() + other.high.size());
+    Ranges::const_iterator i = high.begin();
+    Ranges::const_iterator j = other.high.begin();
+    while (i != high.end() || j != other.high.end()) {
+        const Range& r = (j == other.high.end() || (i != high.end() && i->first <= j->first)) ? *i++ : *j++;
+        if (!merged.empty() && merged.back().second + 1 >= r.first) {
+            merged.back().second = std::max(merged.back().second, r.second);
+        } else {
+            merged.push_back(r);
+        }
+    }
+    high = std::move(merged);
+    return *this;
+}
+
+CharSet& CharSet::operator&=(const CharSet& other) {
+    low &= other.low;
+    high = intersect(high, other.high);
+    return *this;
+}
+
+CharSet CharSet::operator|(const CharSet& other) const {
+    CharSet result = *this;
+    result |= other;
+    return result;
+}
+
+CharSet CharSet::operator&(const CharSet& other) const {
+    CharSet result = *this;
+    result &= other;
+    return result;
+}
+
+std::string CharSet::format_char(int c) {
+    if (c > 127) {
+        std::stringstream ss;
+        ss << "\\u" << std::setfill('0') << std::setw(4) << std::hex << c;
+        return ss.str();
+    }
+    switch (c) {
+    case '\r': return R"(\r)";
+    case '\n': return R"(\n)";
+    case '\t': return R"(\t)";
+    case '\v': return R"(\v)";
+    case '\f': return R"(\f)";
+    case '[': return R"(\[)";
+    case ']': return R"(\])";
+    case '^': return R"(\^)";
+    case '-': return R"(\-)";
+    case '\\': return R"(\\)";
+    default: return std::string(1, (char)c);
+    }
+}
+
+std::string CharSet::to_string() const {
+    if (is_any()) {
+        return ".";
+    }
+    if (contains(MAX)) {
+        return "[^" + complement().to_string().substr(1);
+    }
+    std::string result = "[";
+    for (const Range& r : ranges()) {
+        result += format_char(r.first);
+        if (r.second > r.first + 1) {
+            result += '-';
+        }
+        if (r.second > r.first) {
+            result += format_char(r.second);
+        }
+    }
+    return result + "]";
+}
+
+bool operator==(const CharSet& a, const CharSet& b) {
+    return a.low == b.low && a.high == b.high;
+}
+
+bool operator!=(const CharSet& a, const CharSet& b) {
+    return !(a == b);
+}
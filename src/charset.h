@@ -0,0 +1,52 @@
+#pragma once
+#include <bitset>
+#include <string>
+#include <vector>
+
+class CharSet {
+public:
+    using Range = std::pair<int, int>;
+    using Ranges = std::vector<Range>;
+
+    static constexpr int MAX = 0x10FFFF;
+    static constexpr int BITMAP_SIZE = 256;
+
+    CharSet();
+    CharSet(int c);
+    CharSet(int first, int last);
+    CharSet(const Ranges& ranges);
+
+    static CharSet any();
+
+    void add(int first, int last);
+    CharSet complement() const;
+
+    bool empty() const;
+    bool is_any() const;
+    bool contains(int c) const;
+    bool intersects(const CharSet& other) const;
+    bool is_subset_of(const CharSet& other) const;
+    int min() const;
+    int max() const;
+    Ranges ranges() const;
+
+    CharSet& operator|=(const CharSet& other);
+    CharSet& operator&=(const CharSet& other);
+    CharSet operator|(const CharSet& other) const;
+    CharSet operator&(const CharSet& other) const;
+
+    static std::string format_char(int c);
+    std::string to_string() const;
+
+    friend bool operator==(const CharSet& a, const CharSet& b);
+private:
+    // characters below BITMAP_SIZE are stored in bitmap, the rest as sorted and coalesced ranges
+    std::bitset<BITMAP_SIZE> low;
+    Ranges high;
+
+    void add_high(int first, int last);
+    static Ranges intersect(const Ranges& a, const Ranges& b);
+};
+
+bool operator==(const CharSet& a, const CharSet& b);
+bool operator!=(const CharSet& a, const CharSet& b);
@@ -1,4 +1,6 @@
 #include "checker.h"
+#include "ast/visit.h"
+#include "cost_model.h"
 #include "packcc_wrapper.h"
 #include "config.h"
 #include "utils.h"
@@ -10,6 +12,7 @@
 #include <filesystem>
 #include <algorithm>
 #include <chrono>
+#include <map>
 
 #include <stdio.h>
 #include <unistd.h>
@@ -26,23 +29,65 @@ const int COL_WIDTH = 10;
 std::string Stats::compare(const Stats& s) const {
     std::string result;
     #define COL(X) ((X > 0) ? (" | " + left_pad(#X, COL_WIDTH)) : EMPTY)
-    result += "        " + COL(lines) + COL(bytes) + COL(rules) + COL(terms) + COL(duration) + COL(memory) + "\n";
+    result += "        " + COL(lines) + COL(bytes) + COL(rules) + COL(terms) + COL(duration) + COL(memory) + COL(icache) + "\n";
     #undef COL
     #define COL(X) ((X > 0) ? "-+-----------" : EMPTY)
-    result += "--------" + COL(lines) + COL(bytes) + COL(rules) + COL(terms) + COL(duration) + COL(memory) + "\n";
+    result += "--------" + COL(lines) + COL(bytes) + COL(rules) + COL(terms) + COL(duration) + COL(memory) + COL(icache) + "\n";
     #undef COL
     #define COL(X) ((X > 0) ? (" | " + left_pad(std::to_string(X), COL_WIDTH)) : EMPTY)
-    result += "input   " + COL(s.lines) + COL(s.bytes) + COL(s.rules) + COL(s.terms) + COL(s.duration) + COL(s.memory) + "\n";
-    result += "output  " + COL(lines) + COL(bytes) + COL(rules) + COL(terms) + COL(duration) + COL(memory) + "\n";
+    result += "input   " + COL(s.lines) + COL(s.bytes) + COL(s.rules) + COL(s.terms) + COL(s.duration) + COL(s.memory) + COL(s.icache) + "\n";
+    result += "output  " + COL(lines) + COL(bytes) + COL(rules) + COL(terms) + COL(duration) + COL(memory) + COL(icache) + "\n";
     #undef COL
-    #define COL(X) ((X > 0) ? (" | " + left_pad(std::to_string(X * 100 / s.X) + "%", COL_WIDTH)) : EMPTY)
-    result += "output %" + COL(lines) + COL(bytes) + COL(rules) + COL(terms) + COL(duration) + COL(memory);
+    #define COL(X) ((X > 0) ? (" | " + left_pad(s.X > 0 ? std::to_string(X * 100 / s.X) + "%" : "-", COL_WIDTH)) : EMPTY)
+    result += "output %" + COL(lines) + COL(bytes) + COL(rules) + COL(terms) + COL(duration) + COL(memory) + COL(icache);
     #undef COL
     return result;
 }
 
+std::string Stats::per_rule_table() const {
+    std::vector<std::pair<std::string, RuleCode>> sorted = rule_code;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.bytes > b.second.bytes;
+    });
+    int width = 4;
+    for (const auto& [name, code] : sorted) {
+        width = std::max(width, (int)name.size());
+    }
+    std::string result = right_pad("rule", width);
+    for (const char* column : {"lines", "bytes", "memo", "captures"}) {
+        result += " | " + left_pad(column, COL_WIDTH);
+    }
+    result += "\n" + std::string(width, '-');
+    for (int i = 0; i < 4; i++) {
+        result += "-+-" + std::string(COL_WIDTH, '-');
+    }
+    for (const auto& [name, code] : sorted) {
+        result += "\n" + right_pad(name, width);
+        for (long value : {code.lines, code.bytes, code.memo, code.captures}) {
+            result += " | " + left_pad(std::to_string(value), COL_WIDTH);
+        }
+    }
+    return result;
+}
+
+std::string Stats::per_rule_json() const {
+    std::string result = "[";
+    for (const auto& [name, code] : rule_code) {
+        result += std::string(result.size() > 1 ? "," : "") + "\n    {\"rule\": \"" + name + "\""
+            + ", \"lines\": " + std::to_string(code.lines)
+            + ", \"bytes\": " + std::to_string(code.bytes)
+            + ", \"memo\": " + std::to_string(code.memo)
+            + ", \"captures\": " + std::to_string(code.captures) + "}";
+    }
+    return result + "\n]";
+}
+
+std::set<std::size_t> Checker::validated;
+int Checker::cache_fd = -1;
+
 Checker::Checker() {
-    fs::path tmp_dir = fs::temp_directory_path() / ("pegof_" + std::to_string(time(0)));
+    // pid is needed to avoid collisions between processes started in the same second
+    fs::path tmp_dir = fs::temp_directory_path() / ("pegof_" + std::to_string(getpid()) + "_" + std::to_string(time(0)));
     output = (tmp_dir / "output").native();
     tmp = tmp_dir.native();
     fs::create_directory(tmp_dir);
@@ -95,7 +140,23 @@ bool Checker::packcc(const std::string& peg, const std::string& output) const {
     std::string err;
     fs::path input = fs::path(tmp) / "tmp.peg";
     write_file(input.native(), peg);
-    return call_packcc(input.native(), output, err);
+
+    // PackCC always rewrites the outputs, so remember the previous ones to be able to restore
+    // their timestamps if the content didn't change and build systems don't rebuild them needlessly
+    std::map<std::string, std::pair<std::string, fs::file_time_type>> previous;
+    for (const std::string& path : {output + ".c", output + ".h"}) {
+        if (fs::exists(path)) {
+            previous[path] = {read_file(path), fs::last_write_time(path)};
+        }
+    }
+    bool result = call_packcc(input.native(), output, err);
+    for (const auto& [path, prev] : previous) {
+        if (read_file(path) == prev.first) {
+            log(2, "File %s didn't change, keeping its timestamp", path.c_str());
+            fs::last_write_time(path, prev.second);
+        }
+    }
+    return result;
 }
 
 Stats Checker::stats(Grammar& g) const {
@@ -105,17 +166,66 @@ Stats Checker::stats(Grammar& g) const {
     int terms = g.find_all<Term>().size();
     int duration = 0;
     int memory = 0;
-    benchmark(duration, memory);
+    long icache = 0;
+    benchmark(duration, memory, icache);
     log(2, "Code has %ld bytes and %ld lines", code.size(), lines);
     log(2, "Grammar has %d rules and %d terms", rules, terms);
-    return Stats(code.size(), lines, rules, terms, duration, memory);
+    if (Config::verbose(2)) {
+        CostModel::report(g, code);
+    }
+    Stats result(code.size(), lines, rules, terms, duration, memory, icache);
+    if (!Config::get<std::string>("stats-per-rule").empty()) {
+        std::map<std::string, RuleCode> attributed = CostModel::attribute(code);
+        std::vector<std::pair<std::string, RuleCode>> rule_code;
+        for (Rule* rule : g.find_all<Rule>()) {
+            rule_code.push_back({rule->get_name(), attributed[rule->get_name()]});
+        }
+        result.set_rule_code(rule_code);
+    }
+    return result;
+}
+
+std::size_t Checker::code_size(const std::string& peg) const {
+    validate_string("measured.peg", peg);
+    return read_file(output + ".c").size();
+}
+
+void Checker::share_cache(int fd) {
+    cache_fd = fd;
+}
+
+void Checker::load_cache(int fd) {
+    std::size_t hash;
+    while (read(fd, &hash, sizeof(hash)) == sizeof(hash)) {
+        validated.insert(hash);
+    }
 }
 
 bool Checker::validate(const std::string& input) const {
+    // Result can be reused only if it doesn't depend on other files and the generated code is not
+    // needed for stats. Failures are never cached, so that the errors are always reported.
+    std::size_t hash = 0;
+    if (!Config::verbose(1) && Config::get<std::string>("benchmark").empty() && Config::get<std::string>("stats-per-rule").empty()) {
+        std::string content = read_file(input);
+        if (content.find("%import") == std::string::npos) {
+            hash = std::hash<std::string>()(Config::get<std::string>("packcc-options") + '\0' + content);
+        }
+    }
+    if (hash && validated.count(hash)) {
+        log(2, "Grammar %s was already validated", input.c_str());
+        return true;
+    }
+
     std::string errors;
     if (!call_packcc(input, output, errors)) {
         error("Failed to parse grammar by packcc:\n%s", errors.c_str());
     }
+    if (hash && !Config::get<bool>("skip-validation")) {
+        validated.insert(hash);
+        if (cache_fd >= 0 && write(cache_fd, &hash, sizeof(hash)) != sizeof(hash)) {
+            log(2, "Failed to share validation result");
+        }
+    }
     return true;
 }
 
@@ -137,7 +247,18 @@ bool Checker::validate_file(const std::string& filename) const {
     return validate(filename);
 }
 
-void Checker::benchmark(int& duration, int& memory) const {
+bool Checker::is_valid(const std::string& filename, const std::string& peg) const {
+    fs::path input = fs::path(tmp) / filename;
+    write_file(input.native(), peg);
+    std::string errors;
+    if (!call_packcc(input.native(), output, errors)) {
+        log(2, "Grammar %s is not valid:\n%s", filename.c_str(), errors.c_str());
+        return false;
+    }
+    return true;
+}
+
+void Checker::benchmark(int& duration, int& memory, long& icache) const {
     std::string script = Config::get<std::string>("benchmark");
     if (script.empty()) {
         return;
@@ -155,7 +276,12 @@ void Checker::benchmark(int& duration, int& memory) const {
     if (system("which /usr/bin/time 2> /dev/null > /dev/null") == 0) {
         time = "/usr/bin/time -f \"\\n%M\" ";
     }
-    std::string cmd = time + script + " benchmark " + output + " > " + out + " 2>&1";
+    std::string perf_out = tmp + "/perf.out";
+    std::string perf;
+    if (system("perf stat -e L1-icache-load-misses true 2> /dev/null > /dev/null") == 0) {
+        perf = "perf stat -x, -e L1-icache-load-misses -o " + perf_out + " ";
+    }
+    std::string cmd = time + perf + script + " benchmark " + output + " > " + out + " 2>&1";
 
     log(1, "Running benchmark.");
     log(4, "Benchmark command: %s", cmd.c_str());
@@ -176,6 +302,14 @@ void Checker::benchmark(int& duration, int& memory) const {
         std::vector<std::string> lines = split(read_file(out), "\n");
         memory = stoi(lines.back());
     }
+    if (perf.size()) {
+        for (const std::string& line : split(read_file(perf_out), "\n")) {
+            // CSV format: value,unit,event,...; value is "<not counted>" if the counter didn't run
+            if (line.find("L1-icache-load-misses") != std::string::npos && isdigit((unsigned char)line[0])) {
+                icache = stol(line);
+            }
+        }
+    }
     duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
 }
 
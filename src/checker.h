@@ -1,5 +1,9 @@
 #include "ast/grammar.h"
+#include "cost_model.h"
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 class Stats {
     int lines;
@@ -8,27 +12,42 @@ class Stats {
     int terms;
     int duration;
     int memory;
+    long icache;  // instruction cache misses, only measured if perf is available
+    std::vector<std::pair<std::string, RuleCode>> rule_code;  // in grammar order, only with --stats-per-rule
 public:
-    Stats(int bytes, int lines, int rules, int terms, int duration, int memory)
-        : bytes(bytes), lines(lines), rules(rules), terms(terms), duration(duration), memory(memory) {};
+    Stats(int bytes, int lines, int rules, int terms, int duration, int memory, long icache)
+        : bytes(bytes), lines(lines), rules(rules), terms(terms), duration(duration), memory(memory), icache(icache) {};
     std::string compare(const Stats& s) const;
+    int get_bytes() const { return bytes; }
+
+    void set_rule_code(const std::vector<std::pair<std::string, RuleCode>>& code) { rule_code = code; }
+    std::string per_rule_table() const;
+    std::string per_rule_json() const;
 };
 
 class Checker {
+    static std::set<std::size_t> validated;  // hashes of grammars that were already successfully validated
+    static int cache_fd;  // if set, newly validated hashes are also written to this file descriptor
+
     std::string tmp;
     std::string input_file;
     std::string output;
     bool call_packcc(const std::string& input, const std::string& output, std::string& stderr) const;
     bool validate(const std::string& input) const;
-    void benchmark(int& duration, int& memory) const;
+    void benchmark(int& duration, int& memory, long& icache) const;
 public:
     Checker();
     ~Checker();
 
+    static void share_cache(int fd);
+    static void load_cache(int fd);
+
     void set_input_file(const std::string& input);
     bool packcc(const std::string& peg, const std::string& output) const;
     bool validate_string(const std::string& filename, const std::string& peg) const;
     bool validate_file(const std::string& filename) const;
     bool validate(const std::string& filename, const std::string& content) const;
+    bool is_valid(const std::string& filename, const std::string& peg) const;
     Stats stats(Grammar& g) const;
+    std::size_t code_size(const std::string& peg) const;
 };
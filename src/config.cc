@@ -18,7 +18,7 @@ const std::map<std::string, Optimization> opt_mapping = {
     {"inline", O_INLINE},
     {"remove-group", O_REMOVE_GROUP},
     {"single-char-class", O_SINGLE_CHAR_CLASS},
-    //~ {"char-class-negation", O_CHAR_CLASS_NEGATION},
+    {"char-class-negation", O_CHAR_CLASS_NEGATION},
     {"double-negation", O_DOUBLE_NEGATION},
     {"double-quantification", O_DOUBLE_QUANTIFICATION},
     {"repeats", O_REPEATS},
@@ -26,23 +26,39 @@ const std::map<std::string, Optimization> opt_mapping = {
     {"concat-char-classes", O_CONCAT_CHAR_CLASSES},
     {"unused-variable", O_UNUSED_VARIABLE},
     {"unused-capture", O_UNUSED_CAPTURE},
+    {"left-factor", O_LEFT_FACTOR},
+    {"keyword-trie", O_KEYWORD_TRIE},
+    {"char-alternatives", O_CHAR_ALTERNATIVES},
+    {"dead-code", O_DEAD_CODE},
+    {"left-recursion", O_LEFT_RECURSION},
+    {"reorder-rules", O_REORDER_RULES},
+    {"merge-rules", O_MERGE_RULES},
+    {"lookahead", O_LOOKAHEAD},
 };
 
 const std::map<Optimization, const char*> opt_descriptions = {
-    {O_ALL, {"All optimizations: Shorthand option for combination of all available optimizations."}},
+    {O_ALL, {"All optimizations: Shorthand option for combination of all available optimizations, except `reorder-rules`."}},
     {O_NONE, {"No optimizations: Shorthand option for no optimizations."}},
-    {O_INLINE, {"Rule inlining: Some simple rules can be inlined directly into rules that reference them. Reducing number of rules improves the speed of generated parser."}},
+    {O_INLINE, {"Rule inlining: Some simple rules can be inlined directly into rules that reference them. Reducing number of rules improves the speed of generated parser. The rules are chosen using an estimate of the generated code size, see `--max-growth`. Rules referenced with variables can be inlined when their value is computed by a single `$$ = <expression>;` action without side effects and the variable is used exactly once, the variable is then replaced by the expression."}},
     {O_NORMALIZE_CHAR_CLASS, {"Character class optimization: Normalize character classes to avoid duplicities and use ranges where possible. E.g. `[ABCDEFX0-53-9X]` becomes `[0-9A-FX]`."}},
     {O_REMOVE_GROUP, {"Remove unnecessary groups: Some parenthesis can be safely removed without changeing the meaning of the grammar. E.g.: `A (B C) D` becomes `A B C D` or `X (Y)* Z` becomes `X Y* Z`."}},
     {O_SINGLE_CHAR_CLASS, {"Convert single character classes to strings: The code generated for strings is simpler than that generated for character classes. So we can convert for example `[\\n]` to `\"\\n\"`."}},
-    //~ {O_CHAR_CLASS_NEGATION, {"Simplify negation of character classes: Negation of character classes can be written as negative character class (e.g. `![\\n]` -> `[^\\n]`)."}},
+    {O_CHAR_CLASS_NEGATION, {"Simplify negation of character classes: Negative lookahead of characters followed by any character can be written as negative character class (e.g. `![\\n] .` -> `[^\\n]` or `!\"a\" !\"b\" .` -> `[^ab]`)."}},
     {O_DOUBLE_NEGATION, {"Removing double negations: Negation of negation can be ignored, because it results in the original term (e.g. `!(!TERM)` -> `TERM`)."}},
     {O_DOUBLE_QUANTIFICATION, {"Removing double quantifications: If a single term is quantified twice, it is always possible to convert this into a single potfix operator with equel meaning (e.g. `(X+)?` -> `X*`)."}},
     {O_REPEATS, {"Removing unnecessary repeats: Joins repeated rules to single quantity. E.g. \"A A*\" -> \"A+\", \"B* B*\" -> \"B*\" etc."}},
     {O_CONCAT_STRINGS, {"String concatenation: Join adjacent string nodes into one. E.g. `\"A\" \"B\"` becomes `\"AB\"`."}},
     {O_CONCAT_CHAR_CLASSES, {"Character class concatenation: Join adjacent character classes in alternations into one. E.g. `[AB] / [CD]` becomes `[ABCD]`."}},
     {O_UNUSED_VARIABLE, {"Removing unused variables: Variables denoted in grammar (e.g. `e:expression`) which are not used in any source oe error block are discarded."}},
-    {O_UNUSED_CAPTURE, {"Removing unused captures: Captures denoted in grammar, which are not used in any source block, error block or referenced (via `$n`) are discarded."}}
+    {O_UNUSED_CAPTURE, {"Removing unused captures: Captures denoted in grammar, which are not used in any source block, error block or referenced (via `$n`) are discarded."}},
+    {O_LEFT_FACTOR, {"Left factoring: Adjacent alternatives starting with the same terms are merged, so the common prefix is only evaluated once. E.g. `A B / A C` becomes `A (B / C)`."}},
+    {O_KEYWORD_TRIE, {"Keyword trie: Adjacent string alternatives are rewritten into a prefix tree, so that the generated parser compares each common prefix only once. E.g. `\"int\" / \"if\" / \"import\"` becomes `\"i\" (\"nt\" / \"f\" / \"mport\")`."}},
+    {O_CHAR_ALTERNATIVES, {"Merge single character alternatives: Adjacent alternatives matching exactly one character (single character strings and character classes) are merged into one character class, so the generated parser can check them all at once. E.g. `\"+\" / \"-\" / [*/]` becomes `[*+\\-/]`."}},
+    {O_DEAD_CODE, {"Dead code elimination: Rules that can't be reached from the start rule and alternatives that can never match are removed. E.g. in `\"a\" / \"ab\" / X* / Y` the alternative `\"ab\"` is shadowed by `\"a\"` and `Y` is never tried, because `X*` always succeeds."}},
+    {O_LEFT_RECURSION, {"Left recursion elimination: Left recursive rules without actions, captures and variables are rewritten into repetition, which PackCC can evaluate without its costly left recursion support. E.g. `E <- E \"+\" T / T` becomes `E <- T (\"+\" T)*`. Indirect recursion is handled too, when it can be made direct by expanding the rules involved."}},
+    {O_LOOKAHEAD, {"Lookahead simplification: Predicates that can be decided from the first characters of the following term are removed, because each of them costs an extra match attempt. Positive lookahead implied by the following term (e.g. `&[0-9] [0-9]+` or `&X X`) and negative lookahead that can't match where the following term does (e.g. `!\"x\" [0-9]` -> `[0-9]`) are dropped."}},
+    {O_MERGE_RULES, {"Merging identical rules: Rules with structurally equal expressions, including their actions, are replaced by the first of them, so the generated parser has fewer functions and memoization entries. E.g. `A <- [ \\t]* B` and `C <- [ \\t]* B` are merged, all references to `C` then use `A`. Merged rules can make other rules identical, so it is repeated until no more rules can be merged."}},
+    {O_REORDER_RULES, {"Rule reordering: Rules are reordered so that rules calling each other often are next to each other, which improves locality of the generated parser code. The start rule stays first and directives stay in place. It is not included in `all`, because it changes the order of rules in the output, use e.g. `--optimize all,reorder-rules`."}}
 };
 
 void Config::usage(const std::string& error_msg) {
@@ -151,11 +167,15 @@ void Config::process_args(const std::vector<std::string>& arguments, const bool
         if ((arg[0] == '-' && arg.size() > 1) || config_file) {
             // strip leading dashes from arguments (unless we read arguments from config file)
             std::string arg_name = config_file ? arg : arg.substr(arg[1] == '-' ? 2 : 1);
+            if (arg_name.size() == 2 && arg_name[0] == 'O' && arg_name[1] >= '0' && arg_name[1] <= '3') {
+                set_level(arg_name[1] - '0');
+                continue;
+            }
             Option& opt = find_option(arg_name);
             if (&opt == &UNKNOWN_OPTION) {
                 usage("Unknown option: '" + arg + "'\n");
             }
-            std::string next(i+1 == arguments.size() || arguments[i+1][0] == '-' ? "" : arguments[i+1]);
+            std::string next(i+1 == arguments.size() || (arguments[i+1][0] == '-' && arguments[i+1] != "-") ? "" : arguments[i+1]);
             if (opt.value.type() == typeid(MemberFn)) {
                 i += (this->*(std::any_cast<MemberFn>(opt.value)))();
             } else if (opt.value.type() == typeid(MemberFn1)) {
@@ -234,6 +254,11 @@ void Config::post_process() {
     if (inputs.size() != outputs.size()) {
         usage("Number of inputs does not match number of outputs");
     }
+
+    std::string per_rule = Config::get<std::string>("stats-per-rule");
+    if (!per_rule.empty() && per_rule != "table" && per_rule != "json") {
+        usage("Option --stats-per-rule requires argument 'table' or 'json'");
+    }
 }
 
 bool Config::get(const Optimization& opt) {
@@ -301,15 +326,35 @@ int Config::parse_exclude(const std::string& param) {
     return 1;
 }
 
+int Config::set_inline_limit(const std::string& param) {
+    // the old inlining score is not related to code size, the mapping only keeps the default
+    // the same (0.2 -> 10 %) and more inlining for lower limits (0 means any growth)
+    size_t s = 0;
+    double limit = std::stod(param, &s);
+    if (s != param.size()) {
+        usage("Option 'inline-limit' requires an double argument, got '" + param + "'");
+    }
+    int max_growth = limit > 0 ? (int)(2 / limit + 0.5) : 100000;
+    warn("Option --inline-limit is deprecated, use --max-growth instead (using --max-growth %d)", max_growth);
+    find_option("max-growth").value = max_growth;
+    return 1;
+}
+
+void Config::set_level(int level) {
+    // -O1 is meant for quick local iteration, -O3 for release builds
+    static const int FAST = O_ALL & ~(O_INLINE | O_LEFT_FACTOR | O_KEYWORD_TRIE | O_LEFT_RECURSION);
+    static const int optimizations_by_level[] = {O_NONE, FAST, O_ALL, O_ALL};
+    static const int max_growth_by_level[] = {0, 0, 10, 25};
+    optimizations = optimizations_by_level[level];
+    find_option("max-growth").value = max_growth_by_level[level];
+}
+
 int Config::inc_verbosity() {
     verbosity++;
     return 0;
 }
 
-Config::Config(int argc, char **argv) : output_type(OT_FORMAT), optimizations(O_NONE), verbosity(0) {
-    if (instance) {
-        error("Internal error, Config instance already exists!");
-    }
+Config::Config(int argc, char **argv) : output_type(OT_FORMAT), previous(instance), optimizations(O_NONE), verbosity(0) {
     instance = this;
 
     args = {
@@ -320,20 +365,32 @@ Config::Config(int argc, char **argv) : output_type(OT_FORMAT), optimizations(O_
         Option(OG_BASIC, "d", "debug", false, "Output very verbose debug info, implies max verbosity"),
         Option(OG_BASIC, "S", "skip-validation", false, "Skip result validation (useful only for debugging purposes)"),
         Option(OG_BASIC, "b", "benchmark", std::string(), "Benchmarking script, see documentation for details", "SCRIPT"),
+        Option(OG_BASIC, "R", "stats-per-rule", std::string(), "Report lines and bytes of generated code, number of memoized calls and capture slots of each rule,\n        before and after optimization. FORMAT is either 'table' (sorted by code size) or 'json'", "FORMAT"),
+        Option(OG_BASIC, "s", "serve", std::string(), "Run as a server listening on given Unix socket, each request is processed in a forked process\n        Useful to avoid the startup costs when pegof is called many times, e.g. from a build system", "SOCKET"),
+        Option(OG_BASIC, "C", "connect", std::string(), "Send the request to a server started with --serve instead of processing it locally", "SOCKET"),
         Option(OG_IO, "f", "format", OT_FORMAT, "Output formatted grammar (default)"),
         Option(OG_IO, "a", "ast", OT_AST, "Output abstract syntax tree representation"),
+        Option(OG_IO, "A", "annotate", false, "Annotate abstract syntax tree with results of grammar analysis (first characters,\n        nullability and whether the node always succeeds), only useful with --ast"),
         Option(OG_IO, "p", "packcc", OT_PACKCC, "Output source files as if the grammar was passed to packcc"),
         Option(OG_IO, "P", "packcc-options", std::string(), "Additional comma separated options passed to packcc.\n        Supported options are 'lines', 'ascii' and 'debug' and also their short forms 'a', 'l' and 'd'.\n        Note: --lines might not work as expected, because temporary file is used."),
         Option(OG_IO, "n", "inplace", false, "Modify the input files (only when formatting)"),
         Option(OG_IO, "i", "input", &Config::set_input, "Path to file with PEG grammar, multiple paths can be given\n        Value \"-\" can be used to specify standard input\n        Mainly useful for config file\n        If no file or --input is given, read standard input.", "FILE"),
         Option(OG_IO, "o", "output", &Config::set_output, "Output to file (should be repeated if there is more inputs)\n        Value \"-\" can be used to specify standard output\n        Must not be used together with --inplace.", "FILE"),
         Option(OG_IO, "I", "import", &Config::set_import, "Directory where to search for import files (may be repeated for multiple locations)", "PATH"),
+        Option(OG_IO, "D", "depfile", std::string(), "Write dependencies of the outputs (the grammar and all imported files) to FILE in Makefile format\n        Value \"-\" can be used to specify standard output", "FILE"),
         Option(OG_FORMAT, "q", "quotes", QT_DOUBLE, "Switch between double and single quoted strings (defaults to double)", "single/double"),
         Option(OG_FORMAT, "w", "wrap-limit", 1, "Wrap alternations with more than N sequences (default 1)", "N"),
-        Option(OG_OPT, "O", "optimize", &Config::parse_optimize, "Comma separated list of optimizations to apply", "OPT[,...]"),
+        Option(OG_FORMAT, "F", "format-cache", std::string(), "Cache formatted rules in FILE and reformat and validate only the rules that changed since the previous run,\n        only applied when formatting without optimizations. Entries not needed in the last run are dropped,\n        so each grammar should use its own cache file.", "FILE"),
+        Option(OG_OPT, "O", "optimize", &Config::parse_optimize, "Comma separated list of optimizations to apply\n        Predefined levels can be selected using -O0 (none), -O1 (fast optimizations, no inlining),\n        -O2 (all optimizations) and -O3 (all optimizations, max-growth 25)", "OPT[,...]"),
         Option(OG_OPT, "X", "exclude", &Config::parse_exclude, "Comma separated list of optimizations that should not be applied", "OPT[,...]"),
-        Option(OG_OPT, "l", "inline-limit", 0.2, "Minimum inlining score needed for rule to be inlined.\n        Number between 0.0 (inline everything) and 1.0 (most conservative), default is 0.2,\n        only applied when inlining is enabled", "N"),
+        Option(OG_OPT, "g", "max-growth", 10, "Maximum growth of the generated code caused by inlining, in percents of its estimated size (default 10).\n        Rules are inlined in order of the least growth per removed rule call, inlining that makes the code smaller is always done,\n        only applied when inlining is enabled", "N"),
+        Option(OG_OPT, "l", "inline-limit", &Config::set_inline_limit, "Deprecated, use --max-growth instead. Converted to max-growth of 2/N percent,\n        0 means unlimited growth", "N"),
+        Option(OG_OPT, "T", "opt-time-budget", 0.0, "Stop optimizing after given number of seconds and output the best grammar found so far,\n        0 (default) means no limit. The result might differ between runs when the limit is reached", "SECONDS"),
+        Option(OG_OPT, "K", "optimize-cache", std::string(), "Cache optimized rules in FILE and reoptimize only the parts of grammar that changed since the previous run.\n        Each rule is cached together with the final form of the rules it uses, so only the changed rules\n        and the rules using them are reoptimized.\n        Entries not needed in the last run are dropped, so each grammar should use its own cache file.", "FILE"),
+        Option(OG_OPT, "E", "verify-cache", false, "Check that results obtained using --format-cache or --optimize-cache are the same as without them (for testing)"),
         Option(OG_OPT, "N", "no-follow", false, "Do not inline imported files while optimizing."),
+        Option(OG_OPT, "j", "jobs", 0, "Number of threads used to optimize rules in parallel, 0 (default) means one thread per CPU core.\n        The result doesn't depend on the number of threads", "N"),
+        Option(OG_OPT, "L", "left-factor-limit", 1, "Minimum number of terms in common prefix of alternatives needed for left factoring (default 1),\n        only applied when left factoring is enabled", "N"),
     };
     std::vector<std::string> arguments(argv + 1, argv + argc);
     if (argc == 2 && strcmp(argv[1], "--usage-markdown") == 0) {
@@ -343,3 +400,7 @@ Config::Config(int argc, char **argv) : output_type(OT_FORMAT), optimizations(O_
     process_args(arguments, false);
     post_process();
 }
+
+Config::~Config() {
+    instance = previous;
+}
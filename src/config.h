@@ -10,7 +10,7 @@ enum Optimization {
     O_INLINE = 2,
     O_REMOVE_GROUP = 4,
     O_SINGLE_CHAR_CLASS = 8,
-    //~ O_CHAR_CLASS_NEGATION = 16,
+    O_CHAR_CLASS_NEGATION = 16,
     O_DOUBLE_NEGATION = 32,
     O_DOUBLE_QUANTIFICATION = 64,
     O_REPEATS = 128,
@@ -18,7 +18,16 @@ enum Optimization {
     O_CONCAT_CHAR_CLASSES = 512,
     O_UNUSED_VARIABLE = 1024,
     O_UNUSED_CAPTURE = 2048,
-    O_ALL = 4095
+    O_LEFT_FACTOR = 4096,
+    O_KEYWORD_TRIE = 8192,
+    O_CHAR_ALTERNATIVES = 16384,
+    O_DEAD_CODE = 32768,
+    O_LEFT_RECURSION = 65536,
+    O_REORDER_RULES = 131072,  // not part of "all", it only affects layout of the generated code
+    O_MERGE_RULES = 262144,
+    O_LOOKAHEAD = 524288,
+    O_ALL = 917503,
+    O_ANY = O_ALL | O_REORDER_RULES
 };
 
 struct Config {
@@ -71,6 +80,7 @@ struct Config {
 private:
     static Config* instance;
 
+    Config* previous;  // configuration that was active before this one (used when serving requests)
     std::vector<Option> args;
     int optimizations;
     int verbosity;
@@ -89,6 +99,8 @@ private:
     int parse_optimization_config(const std::string& param);
     int parse_optimize(const std::string& param);
     int parse_exclude(const std::string& param);
+    int set_inline_limit(const std::string& param);
+    void set_level(int level);
     int inc_verbosity();
 
     Option& find_option(const std::string& optionName);
@@ -105,4 +117,5 @@ public:
     static bool verbose(int level);
 
     Config(int argc, char **argv);
+    ~Config();
 };
@@ -0,0 +1,245 @@
+#include "cost_model.h"
+#include "ast/visit.h"
+#include "utils.h"
+#include "log.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <regex>
+#include <string.h>
+
+// Constructs PackCC generates code for
+enum Construct {
+    RULE,              // rule function with debug hooks, forward declaration
+    RULE_NAME,         // per character of rule name, it is repeated in the function
+    REFERENCE,         // pcc_apply_rule call and its failure check
+    VARIABLE,          // storing the value of referenced rule
+    CHAR,              // single character string
+    STRING,            // multi-character string, buffer refill
+    STRING_CHAR,       // comparison of each character of string
+    CHAR_CLASS,        // reading UTF-8 character
+    CHAR_CLASS_TOKEN,  // range or single character condition
+    ANY_CHAR,
+    ALTERNATION,       // backtracking state
+    ALTERNATIVE,       // restoring state and labels for each alternative
+    REPETITION,        // loop with backtracking
+    OPTION,
+    PREDICATE,
+    CAPTURE,
+    EXPAND,
+    ACTION,            // thunk creation and the action function with its macros
+    TEXT,              // per character copied from the grammar, i.e. rule names in calls and code of actions
+    CONSTRUCT_COUNT
+};
+
+static const char* CONSTRUCT_NAMES[CONSTRUCT_COUNT] = {
+    "RULE", "RULE_NAME", "REFERENCE", "VARIABLE", "CHAR", "STRING", "STRING_CHAR", "CHAR_CLASS", "CHAR_CLASS_TOKEN",
+    "ANY_CHAR", "ALTERNATION", "ALTERNATIVE", "REPETITION", "OPTION", "PREDICATE", "CAPTURE", "EXPAND", "ACTION", "TEXT"
+};
+
+// Approximate number of bytes PackCC generates for each construct, derived from its code templates.
+// Run benchmark/cost_model.sh to compare them with the code generated for real grammars and to fit new values.
+static const long COST[CONSTRUCT_COUNT] = {
+    900,   // RULE
+    6,     // RULE_NAME
+    85,    // REFERENCE
+    20,    // VARIABLE
+    110,   // CHAR
+    100,   // STRING
+    50,    // STRING_CHAR
+    220,   // CHAR_CLASS
+    45,    // CHAR_CLASS_TOKEN
+    170,   // ANY_CHAR
+    120,   // ALTERNATION
+    110,   // ALTERNATIVE
+    290,   // REPETITION
+    200,   // OPTION
+    220,   // PREDICATE
+    200,   // CAPTURE
+    320,   // EXPAND
+    1100,  // ACTION
+    1,     // TEXT
+};
+
+template <class Add>
+static void count_reference(const Reference& ref, const Add& add) {
+    add(REFERENCE, 1);
+    add(TEXT, ref.get_name().size());
+    if (ref.has_variable()) {
+        add(VARIABLE, 1);
+    }
+}
+
+// Calls add(construct, n) for all constructs in the code generated for the node
+template <class Add>
+static void count(Node& node, const Add& add) {
+    if (Alternation* a = node.as<Alternation>()) {
+        if (a->size() > 1) {
+            add(ALTERNATION, 1);
+            add(ALTERNATIVE, a->size());
+        }
+        for (int i = 0; i < a->size(); i++) {
+            count(a->get(i), add);
+        }
+    } else if (Sequence* s = node.as<Sequence>()) {
+        for (int i = 0; i < s->size(); i++) {
+            count(s->get(i), add);
+        }
+    } else if (Term* t = node.as<Term>()) {
+        count(*(*t)[0], add);
+        if (t->is_prefixed()) {
+            add(PREDICATE, 1);
+        }
+        if (t->is_quantified()) {
+            add(t->is_greedy() ? REPETITION : OPTION, 1);
+        }
+    } else if (String* str = node.as<String>()) {
+        long length = strlen(str->c_str());
+        if (length == 1) {
+            add(CHAR, 1);
+        } else if (length > 1) {
+            add(STRING, 1);
+            add(STRING_CHAR, length);
+        }
+    } else if (CharacterClass* cc = node.as<CharacterClass>()) {
+        if (cc->any_char()) {
+            add(ANY_CHAR, 1);
+        } else {
+            add(CHAR_CLASS, 1);
+            add(CHAR_CLASS_TOKEN, cc->token_count());
+        }
+    } else if (Reference* ref = node.as<Reference>()) {
+        count_reference(*ref, add);
+    } else if (Action* action = node.as<Action>()) {
+        add(ACTION, 1);
+        add(TEXT, action->get_code().size());
+    } else if (node.is<Expand>()) {
+        add(EXPAND, 1);
+    } else if (node.is<Capture>()) {
+        add(CAPTURE, 1);
+        count(*node[0], add);
+    } else if (node.is<Group>() || node.is<Rule>()) {
+        count(*node[0], add);
+    } else {
+        error("unsupported type!");
+    }
+}
+
+long CostModel::node(Node& node) {
+    long result = 0;
+    count(node, [&result](Construct c, long n) { result += COST[c] * n; });
+    return result;
+}
+
+long CostModel::rule(Rule& rule) {
+    return overhead(rule.get_name()) + node(rule);
+}
+
+long CostModel::overhead(const std::string& name) {
+    return COST[RULE] + COST[RULE_NAME] * name.size();
+}
+
+long CostModel::reference(const Reference& ref) {
+    long result = 0;
+    count_reference(ref, [&result](Construct c, long n) { result += COST[c] * n; });
+    return result;
+}
+
+long CostModel::inlining(Rule& rule, Node& inlined, const std::vector<Reference*>& refs, long total) {
+    // each place gets its own copy of the body instead of the call, the rule itself is removed only when
+    // the last references to it are inlined
+    long body = node(inlined);
+    long result = refs.size() >= total ? -CostModel::rule(rule) : 0;
+    for (Reference* ref : refs) {
+        // value action is dropped when inlining into a variable reference
+        long value = ref->has_variable() ? node(*inlined.find_all<Action>()[0]) : 0;
+        result += body - value - reference(*ref);
+    }
+    return result;
+}
+
+// Returns identifier or number following the prefix in line, or empty string if prefix is not found
+static std::string word_after(const std::string& line, const std::string& prefix) {
+    std::size_t pos = line.find(prefix);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += prefix.size();
+    std::size_t end = pos;
+    while (end < line.size() && (isalnum((unsigned char)line[end]) || line[end] == '_')) end++;
+    return line.substr(pos, end - pos);
+}
+
+std::map<std::string, RuleCode> CostModel::attribute(const std::string& code) {
+    static const std::regex rule_function("static pcc_thunk_chunk_t \\*pcc_evaluate_rule_(\\w+)\\(.*");
+    static const std::regex action_function("static void pcc_action_(\\w+)_\\d+\\(.*");
+    std::map<std::string, RuleCode> result;
+    RuleCode* current = nullptr;
+    std::size_t pos = 0;
+    while (pos < code.size()) {
+        std::size_t end = code.find('\n', pos);
+        end = end == std::string::npos ? code.size() : end + 1;
+        std::string line = code.substr(pos, end - pos);
+        std::string text = trim(line, TRIM_RIGHT);
+        std::smatch m;
+        if (!current && text.compare(0, 7, "static ") == 0 && (std::regex_match(text, m, rule_function) || std::regex_match(text, m, action_function))) {
+            current = &result[m.str(1)];
+            if (text.back() == ';') {
+                // just a declaration
+                current->lines++;
+                current->bytes += line.size();
+                current = nullptr;
+            }
+        }
+        std::string called = word_after(line, "pcc_apply_rule(ctx, pcc_evaluate_rule_");
+        if (!called.empty()) {
+            result[called].memo++;
+        }
+        if (current) {
+            std::string captures = word_after(line, "pcc_capture_table__resize(ctx->auxil, &chunk->capts, ");
+            if (!captures.empty()) {
+                current->captures = std::stol(captures);
+            }
+            current->lines++;
+            current->bytes += line.size();
+            if (text == "}") {
+                current = nullptr;
+            }
+        }
+        pos = end;
+    }
+    return result;
+}
+
+void CostModel::report(Grammar& g, const std::string& code) {
+    std::map<std::string, RuleCode> generated = attribute(code);
+    long predicted_total = 0;
+    long generated_total = 0;
+    double rule_error = 0;
+    int measured = 0;
+    for (Rule* r : g.find_all<Rule>()) {
+        long predicted = rule(*r);
+        long actual = generated[r->get_name()].bytes;
+        // the counts of constructs are used by benchmark/cost_model.sh to fit the costs
+        std::vector<long> counts(CONSTRUCT_COUNT, 0);
+        counts[RULE] = 1;
+        counts[RULE_NAME] = r->get_name().size();
+        count(*r, [&counts](Construct c, long n) { counts[c] += n; });
+        std::string constructs;
+        for (int i = 0; i < CONSTRUCT_COUNT; i++) {
+            if (counts[i]) {
+                constructs += " " + std::string(CONSTRUCT_NAMES[i]) + "=" + std::to_string(counts[i]);
+            }
+        }
+        log(3, "  Rule %s: estimated %ld bytes, generated %ld bytes, constructs:%s", r->c_str(), predicted, actual, constructs.c_str());
+        predicted_total += predicted;
+        generated_total += actual;
+        if (actual) {
+            rule_error += std::abs(predicted - actual) * 100.0 / actual;
+            measured++;
+        }
+    }
+    double error = generated_total ? (predicted_total - generated_total) * 100.0 / generated_total : 0;
+    log(2, "Code size of rules was estimated to %ld bytes, %ld bytes were generated (error %+.1f %%, %.1f %% per rule on average)",
+        predicted_total, generated_total, error, measured ? rule_error / measured : 0.0);
+}
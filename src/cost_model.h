@@ -0,0 +1,31 @@
+#pragma once
+#include "ast/grammar.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Part of the generated C code that belongs to a single rule
+struct RuleCode {
+    long lines = 0;
+    long bytes = 0;
+    long memo = 0;      // places where the rule is called, each call looks up and stores its memoized result
+    long captures = 0;  // capture slots allocated for each evaluation of the rule
+};
+
+// Estimates size of the C code that PackCC generates for grammar constructs,
+// so that optimizations can compare alternatives without running PackCC.
+class CostModel {
+public:
+    static long node(Node& node);                       // code matching the expression
+    static long rule(Rule& rule);                       // whole rule, including its function and actions
+    static long overhead(const std::string& name);      // rule function prologue, epilogue and declaration
+    static long reference(const Reference& ref);        // single call of a rule
+    // growth of code caused by inlining the rule into given references, out of total references to the rule
+    static long inlining(Rule& rule, Node& inlined, const std::vector<Reference*>& refs, long total);
+
+    // Splits the generated code by rules it was generated from, code shared by all rules is not included
+    static std::map<std::string, RuleCode> attribute(const std::string& code);
+    // Compares the estimates with the actually generated code
+    static void report(Grammar& g, const std::string& code);
+};
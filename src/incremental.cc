@@ -0,0 +1,381 @@
+#include "incremental.h"
+#include "ast/rule.h"
+#include "ast/directive.h"
+#include "ast/code.h"
+#include "ast/visit.h"
+#include "parser.h"
+#include "config.h"
+#include "utils.h"
+#include "log.h"
+#include "version.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <set>
+
+static const std::string CACHE_VERSION = "pegof-cache 2";
+
+// Returns position after string or character class starting at pos
+static unsigned long skip_quoted(const std::string& s, unsigned long pos, char close) {
+    for (pos++; pos < s.size() && s[pos] != close; pos++) {
+        if (s[pos] == '\\') pos++;
+    }
+    return pos + 1;
+}
+
+// Returns position of the end of line (or end of input)
+static unsigned long skip_line(const std::string& s, unsigned long pos, bool continuable) {
+    while (pos < s.size() && s[pos] != '\n') {
+        if (continuable && s.compare(pos, 2, "\\\n") == 0) pos++;
+        pos++;
+    }
+    return pos;
+}
+
+// Returns position after code block starting at pos, skipping the same things as Parser::match_code
+static unsigned long skip_code(const std::string& s, unsigned long pos) {
+    int level = 0;
+    while (pos < s.size()) {
+        if (s[pos] == '#') {
+            pos = skip_line(s, pos, true);
+        } else if (s.compare(pos, 2, "//") == 0) {
+            pos = skip_line(s, pos, false);
+        } else if (s.compare(pos, 2, "/*") == 0) {
+            unsigned long end = s.find("*/", pos + 2);
+            pos = end == std::string::npos ? s.size() : end + 2;
+        } else if (s[pos] == '"' || s[pos] == '\'') {
+            pos = skip_quoted(s, pos, s[pos]);
+        } else if (s[pos] == '{') {
+            level++;
+            pos++;
+        } else if (s[pos] == '}') {
+            pos++;
+            if (--level == 0) break;
+        } else {
+            pos++;
+        }
+    }
+    return pos;
+}
+
+// Checks whether line starting at pos looks like start of a rule or directive
+static bool is_top_level(const std::string& s, unsigned long pos) {
+    if (s[pos] == '%') {
+        return true;
+    }
+    unsigned long end = pos;
+    while (end < s.size() && !isspace(s[end])) end++;
+    if (end == pos) {
+        return false;
+    }
+    unsigned long arrow = s.find("<-", pos + 1);
+    if (arrow < end) {
+        return true;
+    }
+    while (end < s.size() && (s[end] == ' ' || s[end] == '\t')) end++;
+    return s.compare(end, 2, "<-") == 0;
+}
+
+// Moves the chunk boundary before all comments and empty lines preceding it, because they belong to the next node
+static unsigned long move_back(const std::string& s, unsigned long pos, unsigned long min) {
+    while (pos > min) {
+        unsigned long prev = pos >= 2 ? s.rfind('\n', pos - 2) : std::string::npos;
+        unsigned long start = prev == std::string::npos ? 0 : prev + 1;
+        if (start < min) break;
+        std::string line = trim(s.substr(start, pos - 1 - start));
+        if (!line.empty() && line[0] != '#') break;
+        pos = start;
+    }
+    return pos;
+}
+
+// Splits s at each occurrence of separator, skipping empty items
+static std::vector<std::string> words(const std::string& s, char separator) {
+    std::vector<std::string> result;
+    unsigned long start = 0;
+    while (start < s.size()) {
+        unsigned long end = std::min(s.find(separator, start), s.size());
+        if (end > start) {
+            result.push_back(s.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return result;
+}
+
+static std::string join(const std::set<std::string>& items, const std::string& separator) {
+    std::string result;
+    for (const std::string& item : items) {
+        result += (result.empty() ? "" : separator) + item;
+    }
+    return result;
+}
+
+// The cache format is versioned, but the cached results also depend on the formatter and optimizer,
+// so a cache created by any other build of pegof is not trusted
+Cache::Cache(const std::string& path, const std::string& signature)
+    : path(path), signature(CACHE_VERSION + " " + pegof_version + " " + signature)
+{
+    if (!std::filesystem::exists(path)) {
+        return;
+    }
+    std::string content = read_file(path);
+    unsigned long pos = content.find('\n');
+    if (pos == std::string::npos || content.substr(0, pos) != this->signature) {
+        log(1, "Cache %s was created by different version or with different options, ignoring it", path.c_str());
+        return;
+    }
+    pos++;
+    while (pos < content.size()) {
+        // each entry is "<key length> <value length>\n<key><value>"
+        unsigned long eol = content.find('\n', pos);
+        if (eol == std::string::npos) break;
+        std::vector<std::string> sizes = split(content.substr(pos, eol - pos), " ");
+        if (sizes.size() != 2) break;
+        unsigned long key_size = std::stoul(sizes[0]);
+        unsigned long value_size = std::stoul(sizes[1]);
+        if (eol + 1 + key_size + value_size > content.size()) break;
+        entries[content.substr(eol + 1, key_size)] = content.substr(eol + 1 + key_size, value_size);
+        pos = eol + 1 + key_size + value_size;
+    }
+    if (pos < content.size()) {
+        warn("Cache %s is corrupted, only %ld entries were loaded", path.c_str(), entries.size());
+    }
+    log(2, "Loaded %ld entries from cache %s", entries.size(), path.c_str());
+}
+
+bool Cache::find(const std::string& key, std::string& value) {
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return false;
+    }
+    value = it->second;
+    used[key] = value;
+    return true;
+}
+
+void Cache::store(const std::string& key, const std::string& value) {
+    entries[key] = value;
+    used[key] = value;
+}
+
+void Cache::save() const {
+    // only entries needed in this run are kept, so that the cache doesn't grow indefinitely
+    std::string content = signature + "\n";
+    for (const auto& [key, value] : used) {
+        content += std::to_string(key.size()) + " " + std::to_string(value.size()) + "\n" + key + value;
+    }
+    log(1, "Writing cache %s ...", path.c_str());
+    write_file(path, content);
+}
+
+IncrementalFormatter::IncrementalFormatter(const std::string& path)
+    : cache(path, "format quotes=" + std::to_string(Config::get<Config::QuoteType>("quotes"))
+        + " wrap-limit=" + std::to_string(Config::get<int>("wrap-limit"))),
+      last()
+{}
+
+void IncrementalFormatter::save() const {
+    cache.save();
+}
+
+std::string IncrementalFormatter::header_comments(const std::string& content, unsigned long& end) {
+    // same as Grammar::parse, comments at the very beginning belong to grammar
+    std::string result;
+    end = 0;
+    Parser p(content);
+    while (p.match_comment()) {
+        result += (result.empty() ? "#" : "\n#") + p.last_match;
+        end = content.find('\n', end) + 1;
+    }
+    return result;
+}
+
+std::vector<std::string> IncrementalFormatter::chunks(const std::string& content, unsigned long start) {
+    std::vector<unsigned long> boundaries(1, start);
+    bool line_start = true;
+    char last = 0;
+    unsigned long pos = start;
+    while (pos < content.size()) {
+        // alternation with dangling slash would be accepted in the chunk, but not in the whole grammar
+        if (line_start && last != '/') {
+            bool code = content.compare(pos, 2, "%%") == 0;
+            if (code || is_top_level(content, pos)) {
+                unsigned long boundary = move_back(content, pos, boundaries.back());
+                if (boundary > boundaries.back()) {
+                    boundaries.push_back(boundary);
+                }
+                if (code) break;
+            }
+        }
+        line_start = content[pos] == '\n';
+        if (!isspace(content[pos]) && content[pos] != '#') {
+            last = content[pos];
+        }
+        if (content[pos] == '#') {
+            pos = skip_line(content, pos, false);
+        } else if (content[pos] == '"' || content[pos] == '\'') {
+            pos = skip_quoted(content, pos, content[pos]);
+        } else if (content[pos] == '[') {
+            pos = skip_quoted(content, pos, ']');
+        } else if (content[pos] == '{') {
+            pos = skip_code(content, pos);
+        } else {
+            pos++;
+        }
+    }
+    std::vector<std::string> result;
+    for (int i = 0; i < boundaries.size(); i++) {
+        unsigned long end = i + 1 < boundaries.size() ? boundaries[i + 1] : content.size();
+        result.push_back(content.substr(boundaries[i], end - boundaries[i]));
+    }
+    return result;
+}
+
+bool IncrementalFormatter::render(const std::string& chunk, std::string& result, std::string& summary) {
+    // same as Grammar::parse and Grammar::to_string, but only for a part of the grammar
+    Parser p(chunk);
+    result.clear();
+    summary.clear();
+    while (true) {
+        Rule r(p, nullptr);
+        if (r) {
+            result += (result.empty() ? "" : "\n\n") + r.to_string();
+            std::set<std::string> references;
+            for (const Reference* ref : r.find_all<Reference>()) {
+                references.insert(ref->get_name());
+            }
+            summary += (summary.empty() ? "" : " ") + r.get_name() + "=" + join(references, ",");
+            continue;
+        }
+        Directive d(p, nullptr);
+        if (d) {
+            result += (result.empty() ? "" : "\n\n") + d.to_string();
+            summary += (summary.empty() ? "%" : " %") + d.get_name();
+            continue;
+        }
+        Code code(p, nullptr);
+        if (!code) {
+            return false;
+        }
+        if (!code.empty()) {
+            result += (result.empty() ? "" : "\n\n") + code.to_string();
+        }
+        return true;
+    }
+}
+
+bool IncrementalFormatter::format(const std::string& content, std::string& result) {
+    unsigned long start;
+    result = header_comments(content, start);
+    int hits = 0;
+    last.clear();
+    for (const std::string& source : chunks(content, start)) {
+        Chunk chunk = {source, "", "", false};
+        std::string cached;
+        if (cache.find(source, cached)) {
+            unsigned long eol = cached.find('\n');
+            chunk.summary = cached.substr(0, eol);
+            chunk.formatted = cached.substr(eol + 1);
+            hits++;
+        } else if (render(source, chunk.formatted, chunk.summary)) {
+            cache.store(source, chunk.summary + "\n" + chunk.formatted);
+            chunk.changed = true;
+        } else {
+            log(1, "Failed to format grammar incrementally, formatting it as a whole");
+            return false;
+        }
+        if (!chunk.formatted.empty()) {
+            result += (result.empty() ? "" : "\n\n") + chunk.formatted;
+        }
+        last.push_back(chunk);
+    }
+    if (!result.empty() && result.back() != '\n') {
+        result += "\n";
+    }
+    log(1, "Reused %d of %ld formatted chunks", hits, last.size());
+    return true;
+}
+
+bool IncrementalFormatter::changed_rules(std::string& source, std::string& formatted) const {
+    // Each chunk was validated by PackCC when it was cached, in the grammar it came from. The checks of PackCC
+    // that depend on the rest of the grammar are repeated here for the grammar as a whole, so that only the changed
+    // chunks need to be validated again. Returns false if that is not possible and the whole grammar must be validated.
+    std::map<std::string, std::vector<std::string>> rules;
+    std::set<std::string> used;
+    std::set<std::string> changed;
+    std::string start;
+    for (const Chunk& chunk : last) {
+        for (const std::string& item : words(chunk.summary, ' ')) {
+            if (item[0] == '%') {
+                // directives can import other rules or conflict with directives elsewhere
+                if (chunk.changed || item == "%import") {
+                    log(2, "Grammar contains changed directives or imports, validating it as a whole");
+                    return false;
+                }
+                continue;
+            }
+            unsigned long eq = item.find('=');
+            std::string name = item.substr(0, eq);
+            if (!rules.insert({name, words(item.substr(eq + 1), ',')}).second) {
+                log(2, "Rule %s is defined more than once, validating grammar as a whole", name.c_str());
+                return false;
+            }
+            for (const std::string& ref : rules[name]) {
+                if (ref != name) {
+                    used.insert(ref);
+                }
+            }
+            if (start.empty()) {
+                start = name;
+            }
+            if (chunk.changed) {
+                changed.insert(name);
+            }
+        }
+    }
+    for (const auto& [name, references] : rules) {
+        if (name != start && !used.count(name)) {
+            log(2, "Rule %s is not used, validating grammar as a whole", name.c_str());
+            return false;
+        }
+        for (const std::string& ref : references) {
+            if (!rules.count(ref)) {
+                log(2, "Rule %s is not defined, validating grammar as a whole", ref.c_str());
+                return false;
+            }
+        }
+    }
+
+    // changed rules are checked in a grammar of their own, with a new start rule using all of them
+    // and with simple stubs in place of the rules they reference from other chunks
+    source.clear();
+    formatted.clear();
+    if (changed.empty()) {
+        return true;
+    }
+    std::string validation_start = "pegof_validation";
+    while (rules.count(validation_start)) {
+        validation_start += "_";
+    }
+    source = validation_start + " <- " + join(changed, " ") + "\n\n";
+    formatted = source;
+    for (const Chunk& chunk : last) {
+        // chunk with code has nothing that PackCC would check, and the code must be at the very end
+        if (chunk.changed && !chunk.summary.empty()) {
+            source += chunk.source + "\n\n";
+            formatted += chunk.formatted + "\n\n";
+        }
+    }
+    std::set<std::string> stubs;
+    for (const std::string& name : changed) {
+        for (const std::string& ref : rules[name]) {
+            if (!changed.count(ref) && stubs.insert(ref).second) {
+                source += ref + " <- \"" + ref + "\"\n\n";
+                formatted += ref + " <- \"" + ref + "\"\n\n";
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Persistent map from source text to its processed form, stored in a file between runs
+class Cache {
+    std::string path;
+    std::string signature;  // describes options used to create the cache, mismatching file is ignored
+    std::unordered_map<std::string, std::string> entries;
+    std::unordered_map<std::string, std::string> used;
+public:
+    Cache(const std::string& path, const std::string& signature);
+
+    bool find(const std::string& key, std::string& value);
+    void store(const std::string& key, const std::string& value);
+    void save() const;
+};
+
+class IncrementalFormatter {
+    struct Chunk {
+        std::string source;
+        std::string formatted;
+        std::string summary;  // rules defined in the chunk with the rules they reference, and the directives used
+        bool changed;
+    };
+
+    Cache cache;  // source of a chunk -> its summary and formatted form
+    std::vector<Chunk> last;  // chunks of the last formatted grammar
+
+    static std::string header_comments(const std::string& content, unsigned long& end);
+    static std::vector<std::string> chunks(const std::string& content, unsigned long start);
+    static bool render(const std::string& chunk, std::string& result, std::string& summary);
+
+public:
+    IncrementalFormatter(const std::string& path);
+
+    bool format(const std::string& content, std::string& result);
+    bool changed_rules(std::string& source, std::string& formatted) const;
+    void save() const;
+};
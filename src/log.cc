@@ -1,5 +1,9 @@
 #include "log.h"
 
+#include <mutex>
+
+thread_local std::string* LogBuffer::current = nullptr;
+
 DebugIndent::DebugIndent() {
     DebugIndent::inc();
 }
@@ -9,7 +13,7 @@ DebugIndent::~DebugIndent() {
 };
 
 int DebugIndent::indent(int increment) {
-    static int indent = 0;
+    thread_local int indent = 0;
     indent += increment;
     return indent;
 }
@@ -22,6 +26,24 @@ void DebugIndent::dec() {
     indent(-1);
 }
 
-void DebugIndent::print() {
-    fprintf(stderr, "%*s", indent() * 2, "");
+std::string DebugIndent::print() {
+    return std::string(indent() * 2, ' ');
+}
+
+LogBuffer::LogBuffer(std::string& buffer) : previous(current) {
+    current = &buffer;
+}
+
+LogBuffer::~LogBuffer() {
+    current = previous;
+}
+
+void LogBuffer::write(const std::string& message) {
+    if (current) {
+        current->append(message);
+        return;
+    }
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    fputs(message.c_str(), stderr);
 }
@@ -1,6 +1,7 @@
 #pragma once
 #include "config.h"
 #include <stdio.h>
+#include <string>
 
 class DebugIndent {
     static int indent(int increment = 0);
@@ -9,37 +10,49 @@ public:
     ~DebugIndent();
     static void inc();
     static void dec();
-    static void print();
+    static std::string print();
 };
 
+// Collects all messages logged by current thread, so that output of parallel tasks is not interleaved
+class LogBuffer {
+    static thread_local std::string* current;
+    std::string* previous;
+public:
+    LogBuffer(std::string& buffer);
+    ~LogBuffer();
+
+    static void write(const std::string& message);
+};
+
+template <typename... T>
+std::string format_message(const char* format, T... args) {
+    int size = snprintf(nullptr, 0, format, args...);
+    std::string result(size, '\0');
+    snprintf(result.data(), size + 1, format, args...);
+    return result;
+}
+
 template <typename... T>
 void debug(const char* format, T... args) {
     if (Config::get<bool>("debug")) {
-        DebugIndent::print();
-        fprintf(stderr, format, args...);
-        fprintf(stderr, "\n");
+        LogBuffer::write(DebugIndent::print() + format_message(format, args...) + "\n");
     }
 }
 
 template <typename... T>
 void log(int level, const char* format, T... args) {
     if (Config::verbose(level)) {
-        fprintf(stderr, format, args...);
-        fprintf(stderr, "\n");
+        LogBuffer::write(format_message(format, args...) + "\n");
     }
 }
 
 template <typename... T>
 void warn(const char* format, T... args) {
-    fprintf(stderr, "WARNING: ");
-    fprintf(stderr, format, args...);
-    fprintf(stderr, "\n");
+    LogBuffer::write("WARNING: " + format_message(format, args...) + "\n");
 }
 
 template <typename... T>
 void error [[noreturn]] (const char* format, T... args) {
-    fprintf(stderr, "ERROR: ");
-    fprintf(stderr, format, args...);
-    fprintf(stderr, "\n");
+    LogBuffer::write("ERROR: " + format_message(format, args...) + "\n");
     throw 1;
 }
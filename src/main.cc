@@ -1,21 +1,18 @@
 #include "parser.h"
 #include "ast/grammar.h"
 #include "checker.h"
+#include "incremental.h"
+#include "server.h"
 #include "optimizer.h"
+#include "analysis.h"
 #include "config.h"
 #include "utils.h"
 #include "log.h"
 #include "version.h"
 
-Grammar parse(const std::string& input, const Checker& checker) {
-    std::string content = read_file(input);
-    if (content.empty()) {
-        error("Failed to read grammar '%s'", input.c_str());
-    }
-
-    log(1, "Validating input grammar ...");
-    checker.validate(input, content);
+#include <optional>
 
+Grammar parse(const std::string& input, const std::string& content) {
     log(1, "Parsing grammar ...");
     Parser peg(content);
     Grammar g(peg, input);
@@ -25,33 +22,141 @@ Grammar parse(const std::string& input, const Checker& checker) {
     return g;
 }
 
-void process(const Config::OutputType& output_type, const std::string& input, const std::string& output, const Checker& checker) {
+static std::string escape_make(const std::string& path) {
+    return replace(replace(path, "\\$", "$$$$"), " ", "\\ ");
+}
+
+std::string dependencies(const Config::OutputType& output_type, const std::string& input, const std::string& output, const Grammar& g) {
+    if (output.empty()) {
+        error("Option -D/--depfile requires output to file, use -o/--output or -n/--inplace!");
+    }
+    std::string targets = escape_make(output);
+    if (output_type == Config::OT_PACKCC) {
+        targets = escape_make(output + ".c") + " " + escape_make(output + ".h");
+    }
+    std::string result = targets + ":";
+    if (!input.empty()) {
+        result += " " + escape_make(input);
+    }
+    for (const std::string& path : g.get_imports()) {
+        result += " " + escape_make(path);
+    }
+    return result + "\n";
+}
+
+bool format_incrementally(const std::string& input, const std::string& content, const std::string& output, const Checker& checker, IncrementalFormatter& formatter) {
+    log(1, "Formatting grammar incrementally ...");
+    std::string result;
+    if (!formatter.format(content, result)) {
+        return false;
+    }
+    if (Config::get<bool>("verify-cache")) {
+        log(1, "Verifying incremental formatting ...");
+        if (parse(input, content).to_string() != result) {
+            error("Incrementally formatted grammar differs from the grammar formatted from scratch!");
+        }
+    }
+    std::string changed_source, changed_formatted;
+    if (!formatter.changed_rules(changed_source, changed_formatted)) {
+        log(1, "Validating input grammar ...");
+        checker.validate(input, content);
+        log(1, "Validating formatted grammar ...");
+        checker.validate_string("formatted.peg", result);
+    } else if (changed_source.empty()) {
+        // all the rules were already validated in some previous run
+        log(1, "Skipping validation, no rules changed");
+    } else {
+        log(1, "Validating changed rules ...");
+        if (!checker.is_valid("changed.peg", changed_source) || !checker.is_valid("changed_formatted.peg", changed_formatted)) {
+            // validated again as a whole, so that the errors refer to the actual grammar
+            checker.validate(input, content);
+            checker.validate_string("formatted.peg", result);
+        }
+    }
+    log(1, "Writing formatted output ...");
+    write_file(output, result);
+    return true;
+}
+
+void process(const Config::OutputType& output_type, const std::string& input, const std::string& output, const Checker& checker, IncrementalFormatter* formatter, Cache* optimization_cache, std::string& deps) {
     log(1, "Processing file %s, storing output to %s ...",
         input.empty() ? "stdin" : input.c_str(),
         output.empty() ? "stdout" : output.c_str());
 
-    Grammar g = parse(input, checker);
+    std::string content = read_file(input);
+    if (content.empty()) {
+        error("Failed to read grammar '%s'", input.c_str());
+    }
+
+    bool incremental = formatter && output_type == Config::OT_FORMAT && !Config::get(O_ANY)
+        && Config::get<std::string>("depfile").empty();
+    if (incremental && format_incrementally(input, content, output, checker, *formatter)) {
+        return;
+    }
+
+    log(1, "Validating input grammar ...");
+    checker.validate(input, content);
+
+    Grammar g = parse(input, content);
     g.update_parents();
+    if (!Config::get<std::string>("depfile").empty()) {
+        deps += dependencies(output_type, input, output, g);
+    }
     Stats in_stats = checker.stats(g);
 
-    if (Config::get(O_ALL)) {
+    bool stats = Config::get(O_ANY) && (Config::verbose(1) || !Config::get<std::string>("benchmark").empty());
+    std::optional<Grammar> input_grammar;
+    if (stats && Config::get(O_DEAD_CODE)) {
+        input_grammar.emplace(g);
+    }
+
+    if (Config::get(O_ANY)) {
         log(1, "Optimizing grammar ...");
-        Optimizer opt(g);
+        Optimizer opt(g, optimization_cache);
         g = opt.optimize();
         g.update_parents();
+        if (optimization_cache && Config::get<bool>("verify-cache")) {
+            log(1, "Verifying incremental optimization ...");
+            Grammar scratch = parse(input, content);
+            scratch.update_parents();
+            if (Optimizer(scratch).optimize().to_string() != g.to_string()) {
+                error("Incrementally optimized grammar differs from the grammar optimized from scratch!");
+            }
+        }
     }
 
+    std::string per_rule = Config::get<std::string>("stats-per-rule");
     std::string result;
-    if (output_type != Config::OT_AST) {
+    if (output_type != Config::OT_AST || !per_rule.empty()) {
         log(1, "Validating formatted grammar ...");
         result = g.to_string();
         checker.validate_string("formatted.peg", result);
     }
 
-    if (Config::get(O_ALL) && (Config::verbose(1) || !Config::get<std::string>("benchmark").empty())) {
+    if (stats || (!per_rule.empty() && Config::get(O_ANY))) {
         log(1, "Computing stats ...");
         Stats out_stats = checker.stats(g);
-        log(0, "%s", out_stats.compare(in_stats).c_str());
+        if (stats) {
+            log(0, "%s", out_stats.compare(in_stats).c_str());
+        }
+        if (per_rule == "json") {
+            log(0, "{\"input\": %s, \"output\": %s}", in_stats.per_rule_json().c_str(), out_stats.per_rule_json().c_str());
+        } else if (!per_rule.empty()) {
+            log(0, "Generated code of input grammar:\n%s", in_stats.per_rule_table().c_str());
+            log(0, "Generated code of optimized grammar:\n%s", out_stats.per_rule_table().c_str());
+        }
+    } else if (per_rule == "json") {
+        log(0, "{\"input\": %s}", in_stats.per_rule_json().c_str());
+    } else if (!per_rule.empty()) {
+        log(0, "Generated code of input grammar:\n%s", in_stats.per_rule_table().c_str());
+    }
+    if (input_grammar) {
+        // measured separately, because the other optimizations change the code around the dead parts too
+        input_grammar->update_parents();
+        if (Optimizer(*input_grammar).remove_dead_code() > 0) {
+            long removed = in_stats.get_bytes() - (long)checker.code_size(input_grammar->to_string());
+            log(0, "Dead code elimination removed %ld bytes of generated code", removed);
+        }
     }
 
     switch (output_type) {
@@ -59,10 +164,17 @@ void process(const Config::OutputType& output_type, const std::string& input, co
         log(1, "Writing formatted output ...");
         write_file(output, result);
         break;
-    case Config::OT_AST:
+    case Config::OT_AST: {
+        std::optional<Analysis> analysis;
+        if (Config::get<bool>("annotate")) {
+            log(1, "Analyzing grammar ...");
+            analysis.emplace(g);
+            analysis->update();
+        }
         log(1, "Writing AST ...");
         write_file(output, g.dump() + "\n");
         break;
+    }
     case Config::OT_PACKCC:
         if (output.empty()) error("Option -p/--packcc requires output to file, use -o/--output!");
         log(1, "Processing with PackCC ...");
@@ -73,20 +185,68 @@ void process(const Config::OutputType& output_type, const std::string& input, co
 
 }
 
+int run(const Config& conf) {
+    Checker checker;
+    std::optional<IncrementalFormatter> formatter;
+    if (!Config::get<std::string>("format-cache").empty()) {
+        formatter.emplace(Config::get<std::string>("format-cache"));
+    }
+    std::optional<Cache> optimization_cache;
+    if (!Config::get<std::string>("optimize-cache").empty()) {
+        optimization_cache.emplace(Config::get<std::string>("optimize-cache"), Optimizer::signature());
+    }
+
+    std::string deps;
+    for (int i = 0; i < conf.inputs.size(); i++) {
+        const std::string& input = conf.inputs[i];
+        const std::string& output = conf.outputs[i];
+        checker.set_input_file(input);
+        process(conf.output_type, input, output, checker,
+            formatter ? &*formatter : nullptr, optimization_cache ? &*optimization_cache : nullptr, deps);
+    }
+    if (formatter) {
+        formatter->save();
+    }
+    if (optimization_cache) {
+        optimization_cache->save();
+    }
+    std::string depfile = Config::get<std::string>("depfile");
+    if (!depfile.empty()) {
+        log(1, "Writing dependencies to %s ...", depfile == "-" ? "stdout" : depfile.c_str());
+        write_file(depfile == "-" ? "" : depfile, deps);
+    }
+    return 0;
+}
+
+int run_request(const std::vector<std::string>& arguments) {
+    try {
+        std::vector<char*> argv(1, (char*)"pegof");
+        for (const std::string& arg : arguments) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        Config conf(argv.size(), argv.data());
+        return run(conf);
+    } catch (int e) {
+        return e;
+    }
+}
+
 int main(int argc, char **argv) {
     try {
         Config conf(argc, argv);
         debug("Pegof version: %s", pegof_version.c_str());
         debug("PackCC version: %s", pcc_version.c_str());
-        Checker checker;
 
-        for (int i = 0; i < conf.inputs.size(); i++) {
-            const std::string& input = conf.inputs[i];
-            const std::string& output = conf.outputs[i];
-            checker.set_input_file(input);
-            process(conf.output_type, input, output, checker);
+        std::string socket = Config::get<std::string>("serve");
+        if (!socket.empty()) {
+            Server server(socket);
+            return server.serve(run_request);
+        }
+        socket = Config::get<std::string>("connect");
+        if (!socket.empty()) {
+            return Client(socket).request(conf, argc, argv);
         }
-        return 0;
+        return run(conf);
     } catch (int e) {
         return e;
     }
@@ -1,35 +1,71 @@
 #include "optimizer.h"
+#include "ast/visit.h"
 #include "config.h"
+#include "cost_model.h"
 #include "utils.h"
 #include "log.h"
+#include "packcc_wrapper.h"
 
+#include <cctype>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <regex>
 #include <set>
-#include <math.h>
+#include <thread>
+#include <string.h>
 
-Optimizer::Optimizer(Grammar& g) : g(g) {}
+static int thread_count() {
+    int jobs = Config::get<int>("jobs");
+    return jobs > 0 ? jobs : std::max(1u, std::thread::hardware_concurrency());
+}
+
+Optimizer::Optimizer(Grammar& g, Cache* cache) : g(g), analysis(g), rewriter(), cache(cache), growth(0), growth_budget(0), pool(thread_count()) {}
 
 void Optimizer::warn_once(const std::string& warning) {
+    static std::mutex mutex;
     static std::set<std::string> warnings;
+    std::lock_guard<std::mutex> lock(mutex);
     if (warnings.count(warning) == 0) {
         warn("%s", warning.c_str());
         warnings.insert(warning);
     }
 }
 
-int Optimizer::apply(const Optimization& config, const std::function<bool(Node&, int&)>& transform) {
+std::string Optimizer::signature() {
+    // everything that can change the result of optimization of given rules
+    int optimizations = 0;
+    for (int opt = 1; opt <= O_ALL; opt <<= 1) {
+        if ((opt & O_ALL) && Config::get((Optimization)opt)) {
+            optimizations |= opt;
+        }
+    }
+    return "optimize optimizations=" + std::to_string(optimizations)
+        + " max-growth=" + std::to_string(Config::get<int>("max-growth"))
+        + " left-factor-limit=" + std::to_string(Config::get<int>("left-factor-limit"))
+        + " packcc-options=" + Config::get<std::string>("packcc-options");
+}
+
+template <class Transform>
+int Optimizer::apply(Rule& rule, const Optimization& config, const Transform& transform) {
     if (!Config::get(config)) {
         return 0;
     }
     int optimized = 0;
-    g.map([&optimized, transform](Node& node) mutable -> bool {
+    rule.map([&optimized, &transform](Node& node) -> bool {
         return transform(node, optimized);
     });
     return optimized;
 }
 
-int Optimizer::concat_strings() {
+bool Optimizer::in_scope(const Rule& rule) const {
+    return scope.count(rule.get_name()) > 0;
+}
+
+int Optimizer::concat_strings(Rule& rule) {
     // "A" "B" -> "AB"
-    return apply(O_CONCAT_STRINGS, [](Node& node, int& optimized) -> bool {
+    return apply(rule, O_CONCAT_STRINGS, [](Node& node, int& optimized) -> bool {
         Sequence* s = node.as<Sequence>();
         if (!s) return false;
 
@@ -43,6 +79,8 @@ int Optimizer::concat_strings() {
                     log(1, "Merging adjacent strings: %s + %s", str.c_str(), prev_str->c_str());
                     str.append(prev_str->c_str());
                     s->erase(prev_term);
+                    // terms following the erased one were moved
+                    s->update_parents();
                     optimized++;
                 }
                 prev_str = &str;
@@ -56,9 +94,9 @@ int Optimizer::concat_strings() {
     });
 }
 
-int Optimizer::concat_character_classes() {
+int Optimizer::concat_character_classes(Rule& rule) {
     // [AB] / [CD] -> [ABCD]
-    return apply(O_CONCAT_CHAR_CLASSES, [](Node& node, int& optimized) -> bool {
+    return apply(rule, O_CONCAT_CHAR_CLASSES, [](Node& node, int& optimized) -> bool {
         Alternation* a = node.as<Alternation>();
         if (!a) return false;
 
@@ -86,70 +124,8 @@ int Optimizer::concat_character_classes() {
     });
 }
 
-int optimize_repeating_terms(Term& t1, Term& t2) {
-    if (t1.primary != t2.primary || t1.prefix || t2.prefix)
-        return -1; // do nothing
-    Sequence* s = t1.parent->as<Sequence>();
-
-    if (t1.is_greedy() && t2.is_optional()) {
-        return 2; // delete t2
-    } else if (t1.is_greedy() && !t2.is_optional()) {
-        Alternation* a = s->parent->as<Alternation>();
-        // TODO: implement recursive erase, to avoid this ugly if
-        if (a->size() > 1) {
-            log(1, "Removing %s from %s", STR(*s), STR(*a));
-            a->erase(s);
-            return 0;
-        } else {
-            Optimizer::warn_once("Detected sequence that will never match: " + t1.to_string() + " " + t2.to_string());
-            return -1;
-        }
-    } else if (t1.quantifier == '?') {
-        switch (t2.quantifier) {
-        case '*':
-            return 1; // delete t1
-        case '+':
-            t1.quantifier = 0;
-            return 0;
-        case 0:
-            t1.quantifier = 0;
-            t2.quantifier = '?';
-            return 0;
-        }
-    } else if (t1.quantifier == 0 && t2.quantifier == '*') {
-        t1.quantifier = '+';
-        return 2;  // delete t2
-    }
-    return -1;
-}
-
-int Optimizer::simplify_repeats() {
-    // 1    2: *                  ?                  +                  ""
-    // *       X* X* -> X*        X* X? -> X*        X* X+ -> WARN      X* X -> WARN
-    // +       X+ X* -> X+        X+ X? -> X+        X+ X+ -> WARN      X+ X -> WARN
-    // ?       X? X* -> X*        X? X? -> X? X?     X? X+ -> X X+      X? X -> X X?
-    // ""      X  X* -> X+        X  X? -> X X?      X  X+ -> X X+      X  X -> X X
-    return apply(O_REPEATS, [](Node& node, int& optimized) -> bool {
-        Sequence* s = node.as<Sequence>();
-        if (!s) return false;
-
-        for (int i = 1; i < s->size(); i++) {
-            switch (optimize_repeating_terms(s->get(i-1), s->get(i))) {
-            case -1: continue;
-            case 0: optimized++; return true;
-            case 1: s->erase(i - 1); break;
-            case 2: s->erase(i); break;
-            }
-            s->update_parents();
-            optimized++;
-            return true;
-        }
-        return false;
-    });
-}
-
-int Optimizer::normalize_character_classes() {
-    return apply(O_NORMALIZE_CHAR_CLASS, [](Node& node, int& optimized) -> bool {
+int Optimizer::normalize_character_classes(Rule& rule) {
+    return apply(rule, O_NORMALIZE_CHAR_CLASS, [](Node& node, int& optimized) -> bool {
         CharacterClass* cc = node.as<CharacterClass>();
         if (!cc || cc->any_char()) return false;
         if (cc->normalize()) {
@@ -159,11 +135,14 @@ int Optimizer::normalize_character_classes() {
     });
 }
 
-int Optimizer::single_char_character_classes() {
+int Optimizer::single_char_character_classes(Rule& rule) {
     // [A] -> "A"
-    return apply(O_SINGLE_CHAR_CLASS, [](Node& node, int& optimized) -> bool {
+    bool ascii = analysis.is_ascii();
+    return apply(rule, O_SINGLE_CHAR_CLASS, [ascii](Node& node, int& optimized) -> bool {
         CharacterClass* cc = node.as<CharacterClass>();
         if (!cc || cc->any_char() || cc->is_negative() || !cc->is_single_char()) return false;
+        // in ascii mode, character class matches single byte, while string would contain multiple bytes
+        if (ascii && cc->get_charset().min() >= 0x80) return false;
         Term* parent = cc->get_parent<Term>();
         if (!parent) return false; // should never happen
         log(1, "Optimizing character class: %s", STR(*cc));
@@ -173,70 +152,75 @@ int Optimizer::single_char_character_classes() {
     });
 }
 
-// THIS IS WRONG: '[^xy]' is equal to '![xy] .', not just ![xy]
-//~ int Optimizer::character_class_negations() {
-//~     // ![A] -> [^A]
-//~     // ![^A] -> [A]
-//~     return apply(O_CHAR_CLASS_NEGATION, [](Node& node, int& optimized) -> bool {
-//~         Term* t = node.as<Term>();
-//~         if (!t || !t->contains<CharacterClass>() || !t->is_negative()) return false;
-//~         CharacterClass cc = t->get<CharacterClass>();
-//~         if (cc.any_char()) return false;
-//~         log(1, "Simplifying character class negation: %s", t->c_str());
-//~         cc.flip_negation();
-//~         t->set_prefix(0);
-//~         t->set_content(cc);
-//~         t->update_parents();
-//~         optimized++;
-//~         return true;
-//~     });
-//~ }
-
-int Optimizer::double_negations() {
-    // !(!A) -> A
-    return apply(O_DOUBLE_NEGATION, [](Node& node, int& optimized) -> bool {
-        Term* t = node.as<Term>();
-        if (!t || !t->contains<Group>() || !t->is_negative()) return false;
-        Group group = t->get<Group>();
-        if (!group.has_single_term()) return false;
-        Term inner_term = group.get_first_term();
-        if (!inner_term.is_negative()) return false;
-        log(1, "Optimizing double negation: %s", STR(*t));
-        *t = inner_term;
-        t->set_prefix(0);
-        t->update_parents();
-        optimized++;
+static bool char_set(Term& t, bool ascii, CharSet& chars) {
+    // characters matched by term matching exactly one character, ignoring prefix and quantifier
+    if (t.contains<CharacterClass>()) {
+        CharacterClass& cc = t.get<CharacterClass>();
+        if (cc.any_char()) return false;
+        chars = cc.get_charset();
+        // in ascii mode, parser works with bytes, so only classes of ASCII characters are safe to combine
+        CharSet positive = cc.is_negative() ? chars.complement() : chars;
+        return !ascii || positive.empty() || positive.max() < 0x80;
+    } else if (t.contains<String>()) {
+        const char* str = t.get<String>().c_str();
+        int c = (unsigned char)str[0];
+        int len = ascii ? 1 : utf8_to_utf32(str, &c);
+        // in ascii mode, character classes can only match single byte
+        if (c == 0 || strlen(str) != len || (ascii && c >= 0x80)) return false;
+        chars = CharSet(c);
         return true;
-    });
+    }
+    return false;
 }
 
-int optimize_double_quantifiers(const Term& outer, const Term& inner) {
-    return (inner.quantifier == outer.quantifier) ? outer.quantifier : '*';
-}
+int Optimizer::character_class_negations(Rule& rule) {
+    // ![A] . -> [^A]
+    // !"A" !"B" . -> [^AB]
+    // ![^A] . -> [A]
+    // ![A] .+ -> [^A] .*
+    bool ascii = analysis.is_ascii();
+    return apply(rule, O_CHAR_CLASS_NEGATION, [ascii](Node& node, int& optimized) -> bool {
+        Sequence* s = node.as<Sequence>();
+        if (!s) return false;
 
-int Optimizer::double_quantifications() {
-    // _B__|_B*_|_B?_|_B+_
-    //  A* | A* | A* | A*
-    //  A? | A* | A? | A*
-    //  A+ | A* | A* | A+   e.g.: (A?)? -> A?
-    return apply(O_DOUBLE_QUANTIFICATION, [](Node& node, int& optimized) -> bool {
-        Term* t = node.as<Term>();
-        if (!t || !t->contains<Group>() || !t->is_quantified()) return false;
-        Group group = t->get<Group>();
-        if (!group.has_single_term()) return false;
-        Term inner_term = group.get_first_term();
-        if (!inner_term.is_quantified() || inner_term.is_prefixed()) return false;
-        log(1, "Optimizing double quantification: %s", STR(*t));
-        t->copy_content(inner_term);
-        t->set_quantifier(optimize_double_quantifiers(*t, inner_term));
-        t->update_parents();
-        optimized++;
-        return true;
+        for (int start = 0; start < s->size(); start++) {
+            CharSet excluded;
+            int end = start;
+            for (; end < s->size(); end++) {
+                Term& t = s->get(end);
+                CharSet chars;
+                if (!t.is_negative() || t.is_quantified() || !char_set(t, ascii, chars)) break;
+                excluded |= chars;
+            }
+            if (end == start || end == s->size()) continue;
+
+            // negative lookahead only checks the first character, so '.*' and '.?' can't be merged
+            Term& dot = s->get(end);
+            if (dot.is_prefixed() || dot.is_optional() || !dot.contains<CharacterClass>() || !dot.get<CharacterClass>().any_char()) continue;
+            CharSet remaining = excluded.complement();
+            if (remaining.empty()) continue;
+
+            Term merged(0, 0, CharacterClass(remaining, nullptr), nullptr);
+            log(1, "Merging %d negations with following '%s' into %s", end - start, STR(dot), STR(merged));
+            if (dot.is_greedy()) {
+                dot.set_quantifier('*');
+            } else {
+                s->erase(end);
+            }
+            for (int i = end - 1; i >= start; i--) {
+                s->erase(i);
+            }
+            s->insert(start, Sequence({merged}, nullptr));
+            s->update_parents();
+            optimized++;
+            return true;
+        }
+        return false;
     });
 }
 
-int Optimizer::remove_unnecessary_groups() {
-    return apply(O_REMOVE_GROUP, [](Node& node, int& optimized) -> bool {
+int Optimizer::remove_unnecessary_groups(Rule& rule) {
+    return apply(rule, O_REMOVE_GROUP, [](Node& node, int& optimized) -> bool {
         Alternation* a = node.as<Alternation>();
         if (a) {
             for (int pos = 0; pos < a->size(); pos++) {
@@ -284,8 +268,8 @@ int Optimizer::remove_unnecessary_groups() {
     });
 }
 
-int Optimizer::unused_variables() {
-    return apply(O_UNUSED_VARIABLE, [](Node& node, int& optimized) -> bool {
+int Optimizer::unused_variables(Rule& rule) {
+    return apply(rule, O_UNUSED_VARIABLE, [](Node& node, int& optimized) -> bool {
         Reference* r = node.as<Reference>();
         if (!r || !r->has_variable()) return false;
         Rule* rule = node.get_ancestor<Rule>();
@@ -300,8 +284,8 @@ int Optimizer::unused_variables() {
     });
 }
 
-int Optimizer::unused_captures() {
-    return apply(O_UNUSED_CAPTURE, [](Node& node, int& optimized) -> bool {
+int Optimizer::unused_captures(Rule& rule) {
+    return apply(rule, O_UNUSED_CAPTURE, [](Node& node, int& optimized) -> bool {
         Rule* rule = node.as<Rule>();
         if (!rule) return false;
         std::vector<Capture*> captures = rule->find_all<Capture>();
@@ -343,25 +327,790 @@ int Optimizer::unused_captures() {
     });
 }
 
-static double calculate_score(int term_count, int ref_count) {
-    if (term_count == 1) return 1;
-    if (ref_count <= 1) return 1;
-    return 1.0 / sqrt(term_count * ref_count);
+static bool is_factorable(Term& t) {
+    // terms with side effects or bindings must stay in every alternative
+    return t.find_all<Action>().empty()
+        && t.find_all<Capture>().empty()
+        && t.find_all<Reference>([](const Reference& ref) -> bool {
+        return ref.has_variable();
+    }).empty();
+}
+
+static int common_prefix(Sequence& s1, Sequence& s2) {
+    int i = 0;
+    while (i < s1.size() && i < s2.size() && s1.get(i) == s2.get(i) && is_factorable(s1.get(i))) {
+        i++;
+    }
+    return i;
+}
+
+int Optimizer::left_factoring(Rule& rule) {
+    // A B / A C -> A (B / C)
+    // A B / A   -> A (B)?
+    // A / A B   -> A
+    int limit = Config::get<int>("left-factor-limit");
+    return apply(rule, O_LEFT_FACTOR, [limit](Node& node, int& optimized) -> bool {
+        Alternation* a = node.as<Alternation>();
+        if (!a) return false;
+
+        for (int start = 0; start + 1 < a->size(); start++) {
+            Sequence& first = a->get(start);
+            int prefix = common_prefix(first, a->get(start + 1));
+            if (prefix == 0) continue;
+            int end = start + 2;
+            for (; end < a->size(); end++) {
+                int p = common_prefix(first, a->get(end));
+                if (p == 0) break;
+                prefix = std::min(prefix, p);
+            }
+
+            std::vector<Term> terms;
+            int cost = 0;
+            for (int i = 0; i < prefix; i++) {
+                terms.push_back(first.get(i));
+                cost += first.get(i).find_all<Term>().size();
+            }
+            if (cost < limit) continue;
+
+            // everything after the first alternative that matches just the prefix is unreachable
+            std::vector<Sequence> rests;
+            bool optional = false;
+            for (int i = start; i < end && !optional; i++) {
+                Sequence& s = a->get(i);
+                if (s.size() == prefix) {
+                    optional = true;
+                    continue;
+                }
+                std::vector<Term> rest;
+                for (int j = prefix; j < s.size(); j++) {
+                    rest.push_back(s.get(j));
+                }
+                rests.push_back(Sequence(rest, nullptr));
+            }
+            if (!rests.empty()) {
+                terms.push_back(Term(0, optional ? '?' : 0, Group(Alternation(rests, nullptr), nullptr), nullptr));
+            }
+
+            Sequence factored(terms, nullptr);
+            log(1, "Left factoring %d alternatives into %s", end - start, STR(factored));
+            for (int i = end - 1; i >= start; i--) {
+                a->erase(i);
+            }
+            a->insert(start, Alternation({factored}, nullptr));
+            a->update_parents();
+            optimized++;
+            return true;
+        }
+        return false;
+    });
+}
+
+static int char_length(const std::string& s, int pos) {
+    // compare whole characters, so that multibyte characters are never split into separate strings
+    int c;
+    int len = utf8_to_utf32(s.c_str() + pos, &c);
+    return len > 0 ? std::min(len, (int)s.size() - pos) : 1;
+}
+
+static std::vector<Sequence> string_trie(const std::vector<std::string>& strings, bool& nullable) {
+    // strings with different first character can never match at the same position, so they can be
+    // freely reordered, only the relative order of strings with the same first character matters
+    std::vector<std::string> firsts;
+    std::map<std::string, std::vector<std::string>> groups;
+    nullable = false;
+    for (const std::string& s : strings) {
+        if (s.empty()) {
+            // empty string always matches, anything after it is unreachable
+            nullable = true;
+            break;
+        }
+        std::string first = s.substr(0, char_length(s, 0));
+        if (groups.count(first) == 0) {
+            firsts.push_back(first);
+        }
+        groups[first].push_back(s);
+    }
+
+    std::vector<Sequence> result;
+    for (const std::string& first : firsts) {
+        const std::vector<std::string>& group = groups[first];
+        if (group.size() == 1) {
+            result.push_back(Sequence({Term(0, 0, String(group[0], nullptr), nullptr)}, nullptr));
+            continue;
+        }
+        int len = first.size();
+        while (len < group[0].size()) {
+            int next = len + char_length(group[0], len);
+            bool common = std::all_of(group.begin(), group.end(), [&](const std::string& s) {
+                return s.compare(0, next, group[0], 0, next) == 0;
+            });
+            if (!common) break;
+            len = next;
+        }
+        std::vector<std::string> rests;
+        for (const std::string& s : group) {
+            rests.push_back(s.substr(len));
+        }
+        bool optional;
+        std::vector<Sequence> alternatives = string_trie(rests, optional);
+        std::vector<Term> terms(1, Term(0, 0, String(group[0].substr(0, len), nullptr), nullptr));
+        if (alternatives.size() == 1 && alternatives[0].has_single_term() && alternatives[0].get_first_term().is_simple()) {
+            terms.push_back(alternatives[0].get_first_term());
+            terms.back().set_quantifier(optional ? '?' : 0);
+        } else if (!alternatives.empty()) {
+            terms.push_back(Term(0, optional ? '?' : 0, Group(Alternation(alternatives, nullptr), nullptr), nullptr));
+        }
+        result.push_back(Sequence(terms, nullptr));
+    }
+    return result;
+}
+
+static bool expand_strings(Sequence& s, std::vector<std::string>& strings) {
+    // lists strings matched by sequence in the same order as ordered choice would try them,
+    // only simple strings and tries created by string_trie() are supported
+    if (s.size() == 0 || s.size() > 2 || !s.get(0).is_simple() || !s.get(0).contains<String>()) {
+        return false;
+    }
+    std::string head = s.get(0).get<String>().c_str();
+    if (s.size() == 1) {
+        strings.push_back(head);
+        return true;
+    }
+    Term& tail = s.get(1);
+    if (tail.is_prefixed() || tail.is_greedy()) {
+        return false;
+    }
+    std::vector<std::string> rests;
+    if (tail.contains<String>()) {
+        rests.push_back(tail.get<String>().c_str());
+    } else if (tail.contains<Group>()) {
+        Alternation& a = *tail.get<Group>()[0]->as<Alternation>();
+        for (int i = 0; i < a.size(); i++) {
+            if (!expand_strings(a.get(i), rests)) return false;
+        }
+    } else {
+        return false;
+    }
+    if (tail.is_optional()) {
+        rests.push_back("");
+    }
+    for (const std::string& rest : rests) {
+        strings.push_back(head + rest);
+    }
+    return true;
+}
+
+int Optimizer::keyword_tries(Rule& rule) {
+    // "int" / "in" / "if" / "import" -> "i" ("n" "t"? / "f" / "mport")
+    return apply(rule, O_KEYWORD_TRIE, [](Node& node, int& optimized) -> bool {
+        Alternation* a = node.as<Alternation>();
+        if (!a) return false;
+
+        for (int start = 0; start < a->size(); start++) {
+            std::vector<std::string> strings;
+            int end = start;
+            for (; end < a->size(); end++) {
+                std::vector<std::string> expanded;
+                if (!expand_strings(a->get(end), expanded)) break;
+                strings.insert(strings.end(), expanded.begin(), expanded.end());
+            }
+            if (end - start < 2) continue;
+
+            bool nullable;
+            std::vector<Sequence> trie = string_trie(strings, nullable);
+            if (nullable) {
+                trie.push_back(Sequence({Term(0, 0, String("", nullptr), nullptr)}, nullptr));
+            }
+            if (trie.size() >= end - start) {
+                // no common prefixes (or already a trie), nothing to do
+                start = end;
+                continue;
+            }
+
+            Alternation replacement(trie, nullptr);
+            log(1, "Rewriting %d alternatives into trie %s", end - start, STR(replacement));
+            for (int i = end - 1; i >= start; i--) {
+                a->erase(i);
+            }
+            a->insert(start, replacement);
+            a->update_parents();
+            optimized++;
+            return true;
+        }
+        return false;
+    });
+}
+
+static bool single_char(Term& t, bool ascii, CharSet& chars) {
+    // alternatives of terms with quantifiers or negations can't be merged, e.g. "A"+ / "B"+ is not [AB]+
+    if (t.is_quantified() || t.is_negative()) return false;
+    if (t.contains<CharacterClass>() && t.get<CharacterClass>().is_negative()) return false;
+    return char_set(t, ascii, chars);
+}
+
+int Optimizer::char_alternatives(Rule& rule) {
+    // "+" / "-" / [*/] -> [*+\-/]
+    bool ascii = analysis.is_ascii();
+    return apply(rule, O_CHAR_ALTERNATIVES, [ascii](Node& node, int& optimized) -> bool {
+        Alternation* a = node.as<Alternation>();
+        if (!a) return false;
+
+        for (int start = 0; start < a->size(); start++) {
+            CharSet chars;
+            int end = start;
+            for (; end < a->size(); end++) {
+                Sequence& s = a->get(end);
+                CharSet cs;
+                if (!s.has_single_term() || !single_char(s.get(0), ascii, cs)) break;
+                if (!s.get(0).same_prefix(a->get(start).get(0))) break;
+                chars |= cs;
+            }
+            if (end - start < 2) continue;
+
+            Term merged = a->get(start).get(0);
+            merged.set_content(CharacterClass(chars, nullptr));
+            log(1, "Merging %d single character alternatives into %s", end - start, STR(merged));
+            for (int i = end - 1; i >= start; i--) {
+                a->erase(i);
+            }
+            a->insert(start, Alternation({Sequence({merged}, nullptr)}, nullptr));
+            a->update_parents();
+            optimized++;
+            return true;
+        }
+        return false;
+    });
+}
+
+static bool shadows(Sequence& first, Sequence& second) {
+    // "a" / "ab": second alternative is only tried when the input doesn't start with "a", so it can't match
+    if (!first.has_single_term() || !first.get(0).is_simple() || !first.get(0).contains<String>()) return false;
+    Term& t = second.get(0);
+    if (t.is_prefixed() || t.is_optional() || !t.contains<String>()) return false;
+    std::string prefix = first.get(0).get<String>().c_str();
+    return std::string(t.get<String>().c_str()).compare(0, prefix.size(), prefix) == 0;
+}
+
+static bool is_removable(Sequence& s) {
+    // removing captures would renumber the following ones and variables might be used in actions
+    return s.find_all<Capture>().empty() && s.find_all<Reference>([](const Reference& ref) -> bool {
+        return ref.has_variable();
+    }).empty();
+}
+
+int Optimizer::dead_alternatives(Rule& rule) {
+    // "a" / "ab" -> "a"
+    // X* / Y -> X*
+    const Analysis& analysis = this->analysis;
+    return apply(rule, O_DEAD_CODE, [&analysis, &rule](Node& node, int& optimized) -> bool {
+        Alternation* a = node.as<Alternation>();
+        if (!a) return false;
+
+        for (int i = 0; i + 1 < a->size(); i++) {
+            Sequence& s = a->get(i);
+            bool always = analysis.get(s).always;
+            std::vector<int> dead;
+            for (int j = i + 1; j < a->size(); j++) {
+                if (!(always || shadows(s, a->get(j))) || !is_removable(a->get(j))) continue;
+                Optimizer::warn_once("Alternative '" + a->get(j).to_string() + "' in rule " + rule.get_name()
+                    + " can never match, because '" + s.to_string() + "'"
+                    + (always ? " always succeeds" : " matches its prefix") + ", removing it");
+                dead.push_back(j);
+            }
+            for (int k = dead.size() - 1; k >= 0; k--) {
+                a->erase(dead[k]);
+                optimized++;
+            }
+            if (!dead.empty()) {
+                a->update_parents();
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+int Optimizer::unreachable_rules() {
+    if (!Config::get(O_DEAD_CODE)) {
+        return 0;
+    }
+    // rules referenced only from imported files which were not followed can't be seen here
+    if (!g.find_all<Directive>([](const Directive& d) { return d.is_import(); }).empty()) {
+        return 0;
+    }
+    std::set<std::string> reachable = g.reachable_rules();
+    std::vector<Rule*> rules = g.find_all<Rule>();
+    std::vector<Rule*> removed;
+    for (Rule* rule : rules) {
+        if (reachable.count(rule->get_name())) continue;
+        Optimizer::warn_once("Rule " + rule->get_name() + " is not reachable from the start rule, removing it");
+        removed.push_back(rule);
+    }
+    // erasing from the back keeps the pointers to preceding rules valid
+    for (int i = removed.size() - 1; i >= 0; i--) {
+        g.erase(removed[i]);
+    }
+    if (!removed.empty()) {
+        g.update_parents();
+        analysis.update();
+    }
+    return removed.size();
+}
+
+int Optimizer::merge_rules() {
+    if (!Config::get(O_MERGE_RULES)) {
+        return 0;
+    }
+    // rules referenced from imported files which were not followed can't be renamed
+    if (!g.find_all<Directive>([](const Directive& d) { return d.is_import(); }).empty()) {
+        return 0;
+    }
+    int merged = 0;
+    // merging rules can make the rules referencing them identical, so repeat until nothing changes
+    while (true) {
+        std::vector<Rule*> rules = g.find_all<Rule>();
+        // references of rules to themselves are anonymized, so that e.g. `A <- "a" A / ""` equals `B <- "a" B / ""`
+        std::vector<Alternation> bodies;
+        for (Rule* rule : rules) {
+            bodies.push_back(*(*rule)[0]->as<Alternation>());
+            for (Reference* ref : bodies.back().find_all<Reference>([rule](const Reference& r) { return r.references(rule); })) {
+                ref->rename("");
+            }
+        }
+        // the first of identical rules is kept, so the start rule is never removed
+        std::map<std::string, std::string> replacements;
+        std::vector<Rule*> removed;
+        for (int i = 0; i < rules.size(); i++) {
+            if (replacements.count(rules[i]->get_name())) continue;
+            for (int j = i + 1; j < rules.size(); j++) {
+                if (replacements.count(rules[j]->get_name()) || bodies[i] != bodies[j]) continue;
+                log(1, "Merging rule %s into identical rule %s", rules[j]->c_str(), rules[i]->c_str());
+                replacements[rules[j]->get_name()] = rules[i]->get_name();
+                removed.push_back(rules[j]);
+            }
+        }
+        if (removed.empty()) {
+            break;
+        }
+        for (Reference* ref : g.find_all<Reference>()) {
+            std::map<std::string, std::string>::iterator it = replacements.find(ref->get_name());
+            if (it != replacements.end()) {
+                ref->rename(it->second);
+            }
+        }
+        // erasing from the back keeps the pointers to preceding rules valid
+        std::sort(removed.begin(), removed.end(), [&rules](Rule* a, Rule* b) {
+            return std::find(rules.begin(), rules.end(), a) < std::find(rules.begin(), rules.end(), b);
+        });
+        for (int i = removed.size() - 1; i >= 0; i--) {
+            g.erase(removed[i]);
+        }
+        g.update_parents();
+        analysis.update();
+        merged += removed.size();
+    }
+    return merged;
+}
+
+int Optimizer::remove_dead_code() {
+    analysis.update();
+    int removed = unreachable_rules();
+    for (Rule* rule : g.find_all<Rule>()) {
+        int opts = 1;
+        while (opts > 0) {
+            opts = dead_alternatives(*rule);
+            removed += opts;
+        }
+    }
+    g.update_parents();
+    return removed + unreachable_rules();
+}
+
+static bool has_semantics(Node& node) {
+    // actions and captures see the structure of the match, so it must not change
+    return !node.find_all<Action>().empty()
+        || !node.find_all<Capture>().empty()
+        || !node.find_all<Expand>().empty()
+        || !node.find_all<Reference>([](const Reference& ref) -> bool {
+        return ref.has_variable();
+    }).empty();
+}
+
+static bool is_left_recursive(Sequence& s, const std::string& name) {
+    Term& t = s.get(0);
+    return s.size() > 1 && t.is_simple() && t.contains<Reference>() && t.get<Reference>().get_name() == name;
+}
+
+std::set<std::string> Optimizer::left_references(Alternation& a) const {
+    // rules that might be called before anything is consumed, e.g. both A and B in A? B C
+    std::set<std::string> result;
+    for (int i = 0; i < a.size(); i++) {
+        Sequence& s = a.get(i);
+        for (int j = 0; j < s.size(); j++) {
+            Term& t = s.get(j);
+            for (Reference* ref : t.find_all<Reference>()) {
+                result.insert(ref->get_name());
+            }
+            if (!analysis.get(t).nullable) break;
+        }
+    }
+    return result;
+}
+
+bool Optimizer::left_reaches(const std::map<std::string, Rule*>& rules, const std::string& from, const std::string& to) const {
+    std::set<std::string> visited = {from};
+    std::vector<std::string> stack = {from};
+    while (!stack.empty()) {
+        std::map<std::string, Rule*>::const_iterator it = rules.find(stack.back());
+        stack.pop_back();
+        if (it == rules.end()) continue;
+        for (const std::string& name : left_references(*(*it->second)[0]->as<Alternation>())) {
+            if (name == to) return true;
+            if (visited.insert(name).second) {
+                stack.push_back(name);
+            }
+        }
+    }
+    return false;
+}
+
+std::map<std::string, std::set<std::string>> Optimizer::referrers() {
+    // names of rules referencing each rule, the start rule is referenced from ""
+    std::map<std::string, std::set<std::string>> result;
+    std::vector<Rule*> rules = g.find_all<Rule>();
+    if (!rules.empty()) {
+        result[rules[0]->get_name()].insert("");
+    }
+    for (Rule* rule : rules) {
+        for (Reference* ref : rule->find_all<Reference>()) {
+            result[ref->get_name()].insert(rule->get_name());
+        }
+    }
+    return result;
+}
+
+bool Optimizer::eliminate_left_recursion(
+    Rule& rule,
+    const std::map<std::string, Rule*>& rules,
+    const std::map<std::string, std::set<std::string>>& referrers,
+    std::set<std::string>& expanded
+) {
+    const std::string& name = rule.get_name();
+    Alternation& expression = *rule[0]->as<Alternation>();
+    Alternation work = expression;
+
+    // Indirect recursion is made direct by expanding the rules through which it goes. Only expansions that
+    // keep the meaning are used: reference forming whole alternative (A <- B / C, B <- A x / y gives
+    // A <- A x / y / C) or reference to rule with single alternative (A <- B z, B <- A x gives A <- A x z).
+    // The expanded rules must not be used from anywhere else, because the rewritten rule doesn't grow
+    // through them anymore (with B <- A x / y, "A x" would never match after A <- (y / C) x*), so they
+    // are removed afterwards.
+    auto expandable = [&](const std::string& target) -> bool {
+        std::map<std::string, std::set<std::string>>::const_iterator refs = referrers.find(target);
+        if (refs == referrers.end()) return false;
+        return std::all_of(refs->second.begin(), refs->second.end(), [&](const std::string& from) {
+            return from == name || from == target || expanded.count(from);
+        });
+    };
+    for (int round = 0; round < 8; round++) {
+        bool changed = false;
+        for (int i = 0; i < work.size() && !changed; i++) {
+            Sequence& s = work.get(i);
+            Term& t = s.get(0);
+            if (!t.is_simple() || !t.contains<Reference>()) continue;
+            std::string target = t.get<Reference>().get_name();
+            std::map<std::string, Rule*>::const_iterator it = rules.find(target);
+            if (target == name || it == rules.end() || !left_reaches(rules, target, name)) continue;
+            if (!expandable(target)) continue;
+            Alternation body = *(*it->second)[0]->as<Alternation>();
+            if (s.has_single_term()) {
+                work.erase(i);
+                work.insert(i, body);
+                changed = true;
+            } else if (body.size() == 1) {
+                s.erase(0);
+                s.insert(0, body.get(0));
+                changed = true;
+            }
+            if (changed) {
+                expanded.insert(target);
+            }
+        }
+        if (!changed) break;
+    }
+    work.update_parents();
+
+    // E <- E a / E b / c / d -> E <- (c / d) (a / b)*
+    int recursive = 0;
+    while (recursive < work.size() && is_left_recursive(work.get(recursive), name)) {
+        recursive++;
+    }
+    if (recursive == 0 || recursive == work.size() || has_semantics(work) || analysis.get(name).nullable) {
+        return false;
+    }
+    std::vector<Sequence> tails;
+    for (int i = 0; i < recursive; i++) {
+        Sequence tail = work.get(i);
+        tail.erase(0);
+        tail.update_parents();
+        bool recursion = !tail.find_all<Reference>([&name](const Reference& ref) -> bool {
+            return ref.get_name() == name;
+        }).empty();
+        // nullable tail would make the repetition loop forever
+        if (recursion || analysis.get(tail).nullable) return false;
+        tails.push_back(tail);
+    }
+    std::vector<Sequence> bases;
+    for (int i = recursive; i < work.size(); i++) {
+        // with left recursion hidden in the other alternatives, the growing of the match can't be unrolled
+        Alternation single({work.get(i)}, nullptr);
+        std::set<std::string> left = left_references(single);
+        if (left.count(name) || std::any_of(left.begin(), left.end(), [&](const std::string& ref) {
+            return left_reaches(rules, ref, name);
+        })) {
+            return false;
+        }
+        bases.push_back(work.get(i));
+    }
+
+    Sequence result = bases.size() == 1
+        ? bases[0]
+        : Sequence({Term(0, 0, Group(Alternation(bases, nullptr), nullptr), nullptr)}, nullptr);
+    result.insert(result.size(), Sequence({Term(0, '*', Group(Alternation(tails, nullptr), nullptr), nullptr)}, nullptr));
+    // expanded rules are removed, so the result must not call them anymore
+    bool calls_expanded = !result.find_all<Reference>([&expanded](const Reference& ref) -> bool {
+        return expanded.count(ref.get_name()) > 0;
+    }).empty();
+    if (calls_expanded) {
+        return false;
+    }
+    log(1, "Eliminating left recursion in rule %s", rule.c_str());
+    expression = Alternation({result}, &rule);
+    rule.update_parents();
+    return true;
+}
+
+static bool redundant_lookahead(const Analysis& analysis, Term& predicate, Term& next) {
+    // properties of the predicate content, i.e. what would it match without the prefix
+    Term content = predicate;
+    content.set_prefix(0);
+    Properties p = analysis.get(content);
+    Properties n = analysis.get(next);
+    if (predicate.is_negative()) {
+        // !X Y: if X and Y can't start with the same character, X can't match wherever Y matches
+        return !p.nullable && !n.nullable && !p.first.intersects(n.first);
+    }
+    if (p.always) {
+        return true;
+    }
+    // &X X+: if the following term matches, the predicate must have matched as well
+    Term term = next;
+    term.set_quantifier(0);
+    content.set_quantifier(0);
+    if (!next.is_optional() && content == term) {
+        return true;
+    }
+    // &[0-9] [0-9]+: every character the following term can start with satisfies the predicate
+    CharSet chars;
+    return !n.nullable && char_set(predicate, analysis.is_ascii(), chars) && n.first.is_subset_of(chars);
+}
+
+int Optimizer::lookaheads(Rule& rule) {
+    // &"a" "a" -> "a"
+    // &[0-9] [0-9]+ -> [0-9]+
+    // !"x" "y" -> "y"
+    const Analysis& analysis = this->analysis;
+    return apply(rule, O_LOOKAHEAD, [&analysis](Node& node, int& optimized) -> bool {
+        Sequence* s = node.as<Sequence>();
+        if (!s) return false;
+
+        for (int i = 0; i + 1 < s->size(); i++) {
+            Term& predicate = s->get(i);
+            Term& next = s->get(i + 1);
+            if (!predicate.is_prefixed() || next.is_prefixed() || has_semantics(predicate)) continue;
+            if (!redundant_lookahead(analysis, predicate, next)) continue;
+            log(1, "Removing lookahead '%s', it is decided by the following '%s'", STR(predicate), STR(next));
+            s->erase(i);
+            s->update_parents();
+            optimized++;
+            return true;
+        }
+        return false;
+    });
+}
+
+int Optimizer::left_recursion() {
+    if (!Config::get(O_LEFT_RECURSION)) {
+        return 0;
+    }
+    std::map<std::string, Rule*> rules;
+    for (Rule* rule : g.find_all<Rule>()) {
+        rules[rule->get_name()] = rule;
+    }
+    // rules referenced only from imported files which were not followed can't be seen, so none is expanded
+    bool imports = !g.find_all<Directive>([](const Directive& d) { return d.is_import(); }).empty();
+    std::map<std::string, std::set<std::string>> references;
+    if (!imports) {
+        references = referrers();
+    }
+    std::set<std::string> removed_names;
+    int optimized = 0;
+    for (Rule* rule : g.find_all<Rule>([this](const Rule& r) { return in_scope(r); })) {
+        if (removed_names.count(rule->get_name())) continue;
+        if (!left_reaches(rules, rule->get_name(), rule->get_name())) continue;
+        std::set<std::string> expanded;
+        if (eliminate_left_recursion(*rule, rules, references, expanded)) {
+            analysis.update(*rule);
+            dirty.insert(rule->get_name());
+            optimized++;
+            for (const std::string& name : expanded) {
+                log(1, "Removing rule %s, it was expanded into %s", name.c_str(), rule->c_str());
+                removed_names.insert(name);
+            }
+            if (!imports) {
+                references = referrers();
+            }
+        }
+    }
+    std::vector<Rule*> removed;
+    for (Rule* rule : g.find_all<Rule>()) {
+        if (removed_names.count(rule->get_name())) {
+            removed.push_back(rule);
+        }
+    }
+    // erasing from the back keeps the pointers to preceding rules valid
+    for (int i = removed.size() - 1; i >= 0; i--) {
+        g.erase(removed[i]);
+    }
+    if (!removed.empty()) {
+        g.update_parents();
+        analysis.update();
+    }
+    return optimized;
+}
+
+// Extracts <expr> from action "$$ = <expr>;"
+static bool value_expression(const Action& action, std::string& expr) {
+    static const std::regex assignment("^\\$\\$\\s*=\\s*([^;]+?)\\s*;?\\s*$");
+    std::smatch m;
+    if (!std::regex_match(action.get_code(), m, assignment) || m.str(1).find("$$") != std::string::npos) {
+        return false;
+    }
+    expr = m.str(1);
+    return true;
+}
+
+// Rule can be inlined into a variable reference only if its value is computed by single "$$ = <expr>;"
+// action at the end of its only sequence, so that the variable can be replaced by the expression itself
+static bool value_expression(Rule& rule, std::string& expr) {
+    std::vector<Action*> actions = rule.find_all<Action>();
+    if (actions.size() != 1 || !value_expression(*actions[0], expr)) return false;
+    if (!rule.find_all<Reference>([](const Reference& r) { return r.has_variable(); }).empty()) return false;
+    Term* term = actions[0]->get_parent<Term>();
+    Sequence* seq = term->get_parent<Sequence>();
+    Alternation* alt = seq->get_parent<Alternation>();
+    return term->is_simple() && alt->parent == &rule && alt->size() == 1
+        && seq->size() > 1 && &seq->get(seq->size() - 1) == term;
+}
+
+// The value expression is evaluated later after inlining, in the action using the variable. This is only safe
+// if it doesn't depend on any state that could change in between or modify it, so the only identifiers allowed
+// are the value type (used in casts) and functions from C standard library computing the result from arguments.
+static bool is_pure(const std::string& expr, const std::string& value_type) {
+    static const std::set<std::string> functions = {"atoi", "atol", "atoll", "atof", "abs", "labs", "llabs"};
+    std::set<std::string> names = functions;
+    std::string word;
+    for (char c : value_type + " ") {
+        if (isalnum((unsigned char)c) || c == '_') {
+            word += c;
+        } else if (!word.empty()) {
+            names.insert(word);
+            word.clear();
+        }
+    }
+    return Action(expr, nullptr).uses_only(names);
+}
+
+// Variable can be replaced by the value expression only if it is bound just once in the rule, used exactly
+// once (so the value is neither computed repeatedly nor dropped) and only in the same sequence
+static bool can_replace_variable(Reference& ref, const std::string& expr) {
+    Term* term = ref.get_parent<Term>();
+    Rule* dest = ref.get_ancestor<Rule>();
+    if (!term->is_simple()) return false;
+    Action value(expr, nullptr);
+    for (Reference* r : dest->find_all<Reference>([](const Reference& r) { return r.has_variable(); })) {
+        if (value.count_variable(r->get_variable()) > 0) return false;
+        if (r != &ref && r->get_variable() == ref.get_variable()) return false;
+    }
+    auto count_uses = [&ref](Node& node) {
+        int count = 0;
+        for (Action* a : node.find_all<Action>()) count += a->count_variable(ref.get_variable());
+        return count;
+    };
+    int uses = count_uses(*dest);
+    return uses == 1 && uses == count_uses(*term->parent);
+}
+
+// '$0' in an action stands for the text matched by the rule up to that action, while the explicit capture
+// replacing it after inlining covers the whole rule. These are the same only for actions ending the rule.
+static bool whole_match_captures(Rule& rule) {
+    for (Action* a : rule.find_all<Action>([](const Action& a) { return a.contains_capture(0); })) {
+        Term* term = a->get_parent<Term>();
+        Sequence* seq = term->get_parent<Sequence>();
+        if (seq->parent != &rule.get_expression() || &seq->get(seq->size() - 1) != term) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Converts rule to group, wrapping it in explicit capture if its actions use '$0'
+static Group inlined_group(Rule& rule) {
+    std::vector<Action*> actions = rule.find_all<Action>([](const Action& a) { return a.contains_capture(0); });
+    if (actions.empty()) {
+        return rule.convert_to_group();
+    }
+    Rule copy = rule;
+    copy.update_parents();
+    int captures = copy.find_all<Capture>().size();
+    for (Action* a : copy.find_all<Action>()) {
+        for (int k = captures; k >= 0; k--) {
+            a->renumber_capture(k, k + 1);
+        }
+    }
+    Term capture(0, 0, Capture(copy.convert_to_group().convert_to_alternation(), nullptr), nullptr);
+    return Group(Alternation({Sequence({capture}, nullptr)}, nullptr), nullptr);
 }
 
 int Optimizer::inline_rules() {
     if (!Config::get(O_INLINE)) {
         return 0;
     }
-    double best_score = 0;
+    double best_cost = 0;
+    long best_growth = 0;
     int candidate = -1;
     int optimized = 0;
-    double min_score = Config::get<double>("inline-limit");
+    std::string value_type = "int";
+    for (Directive* d : g.find_all<Directive>([](const Directive& d) { return d.get_name() == "value"; })) {
+        value_type = d->get_value();
+    }
+
+    // rules are inlined only into the rules being optimized, these can use rules optimized before them
+    std::map<std::string, std::vector<Reference*>> used;
+    for (Rule* rule : g.find_all<Rule>([this](const Rule& r) { return in_scope(r); })) {
+        for (Reference* ref : rule->find_all<Reference>()) {
+            used[ref->get_name()].push_back(ref);
+        }
+    }
 
     std::vector<Rule*> rules = g.find_all<Rule>();
     // intentionally skipping the first rule, because it is the main one, which can't be inlined anyway
     for (int i = rules.size() - 1; i > 0; i--) {
         Rule& rule = *rules[i];
+        std::map<std::string, std::vector<Reference*>>::iterator it = used.find(rule.get_name());
+        if (it == used.end()) continue;
+        const std::vector<Reference*>& refs = it->second;
+        long total = refs.size() + outside[rule.get_name()];
 
         // check for direct recursion
         bool is_recursive = !rule.find_all<Reference>([rule](const Reference& ref) -> bool {
@@ -372,48 +1121,61 @@ int Optimizer::inline_rules() {
             continue;
         }
 
-        std::vector<Reference*> refs = g.find_all<Reference>([rule](const Reference& ref) -> bool {
-            return ref.references(&rule);
-        });
-
-        if (std::any_of(refs.begin(), refs.end(), [](Reference* r){
-            return r->has_variable();
+        std::string expr;
+        bool has_value = value_expression(rule, expr) && is_pure(expr, value_type);
+        if (std::any_of(refs.begin(), refs.end(), [&](Reference* r){
+            return r->has_variable() && !(has_value && can_replace_variable(*r, expr));
         })) {
-            log(2, "Not inlining %s: rule is used with variables", rule.c_str());
+            log(2, "Not inlining %s: rule is used with variables that can't be replaced by its value", rule.c_str());
             continue;
         }
 
-        bool contains_full_rule_ref = !rule.find_all<Action>([rule](const Action& ref) -> bool {
-            return ref.contains_capture(0);
-        }).empty();
-        if (contains_full_rule_ref) {
-            log(2, "Not inlining %s: rule contains action with '$0'", rule.c_str());
+        if (!whole_match_captures(rule)) {
+            log(2, "Not inlining %s: '$0' is used before the end of the rule", rule.c_str());
             continue;
         }
 
-        double score = calculate_score(rule.count_terms() + rule.count_cc_tokens(), refs.size());
-        log(4, "Score for %s: %f", rule.c_str(), score);
+        long growth;
+        if (rule.find_all<Action>([](const Action& a) { return a.contains_capture(0); }).empty()) {
+            growth = CostModel::inlining(rule, rule, refs, total);
+        } else {
+            Group inlined = inlined_group(rule);
+            inlined.update_parents();
+            growth = CostModel::inlining(rule, inlined, refs, total);
+        }
+        log(4, "Inlining %s would change code size by %ld bytes", rule.c_str(), growth);
+        if (growth > 0 && this->growth + growth > growth_budget) {
+            log(2, "Not inlining %s: code would grow by %ld bytes, which is over the budget", rule.c_str(), growth);
+            continue;
+        }
 
-        if (score > best_score) {
-            best_score = score;
+        // prefer rules that add the least code per each removed call
+        double cost = refs.empty() ? growth : (double)growth / refs.size();
+        if (candidate < 0 || cost < best_cost) {
+            best_cost = cost;
+            best_growth = growth;
             candidate = i;
         }
     }
-    if (candidate >= 0 && best_score >= min_score) {
+    if (candidate >= 0) {
         Rule& rule = *rules[candidate];
-        std::vector<Reference*> refs = g.find_all<Reference>([rule](const Reference& ref) -> bool {
-            return ref.references(&rule);
-        });
+        std::vector<Reference*>& refs = used[rule.get_name()];
 
-        int src_captures = rule.find_all<Capture>().size();
+        Group inlined = inlined_group(rule);
+        inlined.update_parents();
+        int src_captures = inlined.find_all<Capture>().size();
+        std::set<std::string> dest_rules;
 
-        log(1, "Inlining rule %s (score %f)", rule.c_str(), best_score);
+        growth += best_growth;
+        log(1, "Inlining rule %s (code size change %ld bytes)", rule.c_str(), best_growth);
         for (int j = 0; j < refs.size(); j++) {
             Term* dest = refs[j]->parent->as<Term>();
-            Group group = rule.convert_to_group();
+            std::string var = refs[j]->get_variable();
+            Group group = inlined;
             log(2, "  Inlining %s into %s", STR(group), STR(*dest));
             dest->set_content(group);
             dest->update_parents();
+            dest_rules.insert(dest->get_ancestor<Rule>()->get_name());
             // fix capture references in expands and actions
             if (src_captures) {
                 Rule* dest_rule = dest->get_ancestor<Rule>();
@@ -431,10 +1193,11 @@ int Optimizer::inline_rules() {
                     // example: input:   <1> <2> (<1> <2> <3>) <3> <4>
                     //          shift:            +2  +2  +2   +3  +3
                     //          output:  <1> <2> (<3> <4> <5>) <6> <7>
+                    // references to the captures before the group (<= N) are kept as they are
                     dest_rule->update_captures();
                     bool after = false;
                     int shift = 0;
-                    dest_rule->map([&](Node& node) mutable {
+                    dest_rule->map([&](Node& node) {
                         if (node.is_descendant_of(dest)) {
                             after = true;
                             return false;
@@ -443,7 +1206,7 @@ int Optimizer::inline_rules() {
                             shift++;
                             return false;
                         }
-                        if (after && node.is<Expand>()) {
+                        if (after && node.is<Expand>() && !(*node.as<Expand>() <= shift)) {
                             std::string prev = node.to_string();
                             Expand *e = node.as<Expand>();
                             e->shift(src_captures);
@@ -451,7 +1214,7 @@ int Optimizer::inline_rules() {
                         } else if (after && node.is<Action>()) {
                             std::string prev = node.to_string();
                             Action *a = node.as<Action>();
-                            for (int k = dest_captures; k >= 1; k--) {
+                            for (int k = dest_captures - src_captures; k > shift; k--) {
                                 a->renumber_capture(k, k + src_captures);
                             }
                             log(2, "  Update action: %s -> %s", prev.c_str(), STR(node));
@@ -476,37 +1239,475 @@ int Optimizer::inline_rules() {
                     });
                 }
             }
+            if (!var.empty()) {
+                // the value action is replaced by its expression in all places where the variable was used
+                Action* action = dest->get<Group>().find_all<Action>()[0];
+                std::string expr;
+                value_expression(*action, expr);
+                Term* term = action->get_parent<Term>();
+                term->get_parent<Sequence>()->erase(term);
+                dest->update_parents();
+                std::string replacement = "((" + value_type + ")(" + expr + "))";
+                for (Action* a : dest->get_ancestor<Rule>()->find_all<Action>()) {
+                    if (a->count_variable(var) == 0) continue;
+                    std::string prev = a->to_string();
+                    a->replace_variable(var, replacement);
+                    log(2, "  Update action: %s -> %s", prev.c_str(), STR(*a));
+                }
+            }
             debug("  Inlining result: %s", STR(*dest));
         }
-        log(2, "  Removing inlined rule %s", rule.c_str());
-        g.erase(&rule);
+        if (in_scope(rule) && outside[rule.get_name()] == 0) {
+            log(2, "  Removing inlined rule %s", rule.c_str());
+            g.erase(&rule);
+        }
+        // rules optimized before are final, they are removed at the end if they are not used anymore
         g.update_parents();
+        std::vector<Rule*> updated = g.find_all<Rule>([&dest_rules](const Rule& r) -> bool {
+            return dest_rules.count(r.get_name()) > 0;
+        });
+        for (Rule* r : updated) {
+            analysis.update(*r);
+        }
+        dirty.insert(dest_rules.begin(), dest_rules.end());
         optimized++;
         return true;
     }
     return false;
 }
 
-Grammar Optimizer::optimize() {
+int Optimizer::reorder_rules() {
+    // Pettis-Hansen style clustering: rules that call each other most often are placed next to each other,
+    // so that their functions in the generated parser are close together as well
+    std::vector<Rule*> rules = g.find_all<Rule>();
+    std::map<std::string, int> index;
+    for (int i = 0; i < rules.size(); i++) {
+        index[rules[i]->get_name()] = i;
+    }
+    std::map<std::pair<int, int>, int> calls;
+    for (int i = 0; i < rules.size(); i++) {
+        for (Reference* ref : rules[i]->find_all<Reference>()) {
+            std::map<std::string, int>::iterator it = index.find(ref->get_name());
+            if (it != index.end() && it->second != i) {
+                calls[std::minmax(i, it->second)]++;
+            }
+        }
+    }
+    std::vector<std::pair<std::pair<int, int>, int>> edges(calls.begin(), calls.end());
+    std::stable_sort(edges.begin(), edges.end(), [](const auto& a, const auto& b) {
+        return a.second > b.second;
+    });
+
+    // merge chains of rules along the edges, starting with the heaviest ones
+    std::vector<std::vector<int>> chains(rules.size());
+    std::vector<int> chain_of(rules.size());
+    for (int i = 0; i < rules.size(); i++) {
+        chains[i] = {i};
+        chain_of[i] = i;
+    }
+    for (const auto& [edge, count] : edges) {
+        int a = chain_of[edge.first];
+        int b = chain_of[edge.second];
+        if (a == b) continue;
+        int u = edge.first;
+        int v = edge.second;
+        if (b == chain_of[0]) {
+            // the start rule must stay first, so its chain always goes first and is never reversed
+            std::swap(a, b);
+            std::swap(u, v);
+        }
+        std::vector<int>& first = chains[a];
+        std::vector<int>& second = chains[b];
+        int pos_u = std::find(first.begin(), first.end(), u) - first.begin();
+        if (a != chain_of[0] && pos_u < first.size() - 1 - pos_u) {
+            std::reverse(first.begin(), first.end());
+        }
+        int pos_v = std::find(second.begin(), second.end(), v) - second.begin();
+        if (pos_v > second.size() - 1 - pos_v) {
+            std::reverse(second.begin(), second.end());
+        }
+        for (int rule : second) {
+            chain_of[rule] = a;
+        }
+        first.insert(first.end(), second.begin(), second.end());
+        second.clear();
+    }
+
+    // chains are ordered by their first rule in the original order
+    std::vector<std::vector<int>*> ordered;
+    for (std::vector<int>& chain : chains) {
+        if (!chain.empty()) {
+            ordered.push_back(&chain);
+        }
+    }
+    std::stable_sort(ordered.begin() + 1, ordered.end(), [](const std::vector<int>* a, const std::vector<int>* b) {
+        return *std::min_element(a->begin(), a->end()) < *std::min_element(b->begin(), b->end());
+    });
+    std::vector<std::string> order;
+    int moved = 0;
+    for (std::vector<int>* chain : ordered) {
+        for (int i : *chain) {
+            moved += i != order.size();
+            order.push_back(rules[i]->get_name());
+        }
+    }
+    if (moved) {
+        log(2, "Reordering rules, %d rules changed position", moved);
+        g.reorder(order);
+    }
+    return moved;
+}
+
+std::vector<std::vector<std::string>> Optimizer::units() {
+    // Rules calling each other (strongly connected components of the reference graph, found by Tarjan's algorithm)
+    // are optimized together. Rules are listed before the rules using them, so that each unit is optimized with
+    // the final form of everything it uses, and its result depends only on these rules.
+    std::vector<Rule*> rules = g.find_all<Rule>();
+    std::map<std::string, std::vector<std::string>> calls;
+    for (Rule* rule : rules) {
+        calls[rule->get_name()];
+        for (Reference* ref : rule->find_all<Reference>()) {
+            calls[rule->get_name()].push_back(ref->get_name());
+        }
+    }
+    std::map<std::string, int> index;
+    std::map<std::string, int> low;
+    std::vector<std::string> stack;
+    std::set<std::string> on_stack;
+    std::vector<std::vector<std::string>> result;
+    std::function<void(const std::string&)> visit = [&](const std::string& name) {
+        int order = index.size();
+        index[name] = order;
+        low[name] = order;
+        stack.push_back(name);
+        on_stack.insert(name);
+        for (const std::string& callee : calls[name]) {
+            if (!calls.count(callee)) {
+                continue;  // rule is not defined in this grammar
+            }
+            if (!index.count(callee)) {
+                visit(callee);
+                low[name] = std::min(low[name], low[callee]);
+            } else if (on_stack.count(callee)) {
+                low[name] = std::min(low[name], index[callee]);
+            }
+        }
+        if (low[name] == index[name]) {
+            std::set<std::string> unit;
+            std::string member;
+            do {
+                member = stack.back();
+                stack.pop_back();
+                on_stack.erase(member);
+                unit.insert(member);
+            } while (member != name);
+            // in grammar order, so that the unit is always processed the same way
+            result.push_back({});
+            for (Rule* rule : rules) {
+                if (unit.count(rule->get_name())) {
+                    result.back().push_back(rule->get_name());
+                }
+            }
+        }
+    };
+    for (Rule* rule : rules) {
+        if (!index.count(rule->get_name())) {
+            visit(rule->get_name());
+        }
+    }
+    return result;
+}
+
+void Optimizer::count_outside_references() {
+    outside.clear();
+    for (Rule* rule : g.find_all<Rule>([this](const Rule& r) { return !in_scope(r); })) {
+        for (Reference* ref : rule->find_all<Reference>()) {
+            outside[ref->get_name()]++;
+        }
+    }
+}
+
+std::set<std::string> Optimizer::referenced() {
+    std::set<std::string> result;
+    for (Rule* rule : g.find_all<Rule>([this](const Rule& r) { return in_scope(r); })) {
+        for (Reference* ref : rule->find_all<Reference>()) {
+            result.insert(ref->get_name());
+        }
+    }
+    return result;
+}
+
+std::string Optimizer::source(bool start) {
+    // the first rule is the start rule and it is never inlined, so it must be part of the key
+    std::string result = start ? "%start\n" : "";
+    for (Rule* rule : g.find_all<Rule>([this](const Rule& r) { return in_scope(r); })) {
+        result += rule->to_string() + "\n\n";
+    }
+    return result;
+}
+
+std::string Optimizer::key(bool start, const std::map<std::string, std::string>& digests) {
+    // Result of optimization of a unit depends on its rules, on the final form of all the rules it uses (described
+    // by their digests) and on how many times are the rules it uses or defines referenced elsewhere (this decides
+    // whether inlining removes them). Changing a rule thus invalidates only its unit and the units using it.
+    std::string result = source(start);
+    std::set<std::string> names = referenced();
+    names.insert(scope.begin(), scope.end());
+    for (const std::string& name : names) {
+        std::map<std::string, std::string>::const_iterator digest = digests.find(name);
+        std::map<std::string, int>::const_iterator count = outside.find(name);
+        result += "%uses " + name + " " + (digest == digests.end() ? "-" : digest->second)
+            + " " + std::to_string(count == outside.end() ? 0 : count->second) + "\n";
+    }
+    return result;
+}
+
+void Optimizer::reuse(const std::string& cached) {
+    std::map<std::string, Rule> optimized;
+    Parser p(cached);
+    while (true) {
+        Rule r(p, &g);
+        if (!r) break;
+        optimized.emplace(r.get_name(), r);
+    }
+    std::vector<Rule*> removed;
+    for (Rule* rule : g.find_all<Rule>([this](const Rule& r) { return in_scope(r); })) {
+        std::map<std::string, Rule>::iterator it = optimized.find(rule->get_name());
+        if (it == optimized.end()) {
+            removed.push_back(rule);
+        } else {
+            *rule = it->second;
+        }
+    }
+    // erasing from the back keeps the pointers to preceding rules valid
+    for (int i = removed.size() - 1; i >= 0; i--) {
+        g.erase(removed[i]);
+    }
+    g.update_parents();
+    // the rules optimized after this unit need to know the properties of its rules
+    if (removed.empty()) {
+        for (Rule* rule : g.find_all<Rule>([this](const Rule& r) { return in_scope(r); })) {
+            analysis.update(*rule);
+        }
+    } else {
+        analysis.update();
+    }
+}
+
+int Optimizer::unused_rules() {
+    // rules inlined everywhere they were used are kept until all rules are optimized, because the units
+    // optimized before the inlining must not change
+    if (!Config::get(O_INLINE)) {
+        return 0;
+    }
+    // rules referenced only from imported files which were not followed can't be seen, only the rules that were
+    // used by the grammar before optimization can be safely removed
+    bool imports = !g.find_all<Directive>([](const Directive& d) { return d.is_import(); }).empty();
+    int total = 0;
+    while (true) {
+        std::set<std::string> used;
+        for (Reference* ref : g.find_all<Reference>()) {
+            used.insert(ref->get_name());
+        }
+        std::vector<Rule*> rules = g.find_all<Rule>();
+        std::vector<Rule*> removed;
+        for (int i = 1; i < rules.size(); i++) {
+            if (!used.count(rules[i]->get_name()) && (!imports || referenced_before.count(rules[i]->get_name()))) {
+                log(2, "Removing unused rule %s", rules[i]->c_str());
+                removed.push_back(rules[i]);
+            }
+        }
+        if (removed.empty()) {
+            break;
+        }
+        // erasing from the back keeps the pointers to preceding rules valid
+        for (int i = removed.size() - 1; i >= 0; i--) {
+            g.erase(removed[i]);
+        }
+        g.update_parents();
+        total += removed.size();
+    }
+    if (total) {
+        analysis.update();
+    }
+    return total;
+}
+
+int Optimizer::optimize_rule(Rule& rule) {
+    int total = 0;
+    int opts = 1;
+    while (opts > 0) {
+        opts = normalize_character_classes(rule);
+        opts += dead_alternatives(rule);
+        opts += remove_unnecessary_groups(rule);
+        opts += left_factoring(rule);
+        opts += keyword_tries(rule);
+        opts += char_alternatives(rule);
+        opts += single_char_character_classes(rule);
+        opts += character_class_negations(rule);
+        opts += lookaheads(rule);
+        opts += rewriter.rewrite(rule);
+        opts += concat_strings(rule);
+        opts += concat_character_classes(rule);
+        opts += unused_variables(rule);
+        opts += unused_captures(rule);
+        total += opts;
+    }
+    return total;
+}
+
+int Optimizer::optimize_rules() {
+    // All passes except inlining look only inside single rule, so each rule can be optimized in its own task.
+    // Log messages are collected per rule and printed in grammar order, to keep the output deterministic.
+    std::vector<Rule*> rules = g.find_all<Rule>([this](const Rule& r) { return dirty.count(r.get_name()) > 0; });
+    dirty.clear();
+    std::vector<int> counts(rules.size(), 0);
+    std::vector<std::string> logs(rules.size());
+    auto flush = [&]() {
+        for (const std::string& messages : logs) {
+            LogBuffer::write(messages);
+        }
+    };
+    try {
+        pool.run(rules.size(), [&](int i) {
+            LogBuffer buffer(logs[i]);
+            counts[i] = optimize_rule(*rules[i]);
+        });
+    } catch (...) {
+        flush();
+        throw;
+    }
+    flush();
+
+    int total = 0;
+    for (int i = 0; i < rules.size(); i++) {
+        if (counts[i]) {
+            analysis.update(*rules[i]);
+            total += counts[i];
+        }
+    }
+    return total;
+}
+
+bool Optimizer::out_of_time() const {
+    return Config::get<double>("opt-time-budget") > 0 && std::chrono::steady_clock::now() > deadline;
+}
+
+long Optimizer::cost() {
+    // inlining is excluded, because its growth is limited by its own budget
+    long size = 0;
+    for (Rule* rule : g.find_all<Rule>()) {
+        size += CostModel::rule(*rule);
+    }
+    return size - growth;
+}
+
+bool Optimizer::optimize_unit() {
     int opts = 1;
     int pass = 1;
-    debug("Input grammar:\n%s", STR(g));
+    dirty = scope;
+    // Budget is computed for each unit separately, so that results don't depend on reusing cached units. Rules
+    // used by the unit contribute by their share of references, so that the budgets add up to the whole grammar.
+    std::map<std::string, int> used;
+    for (Rule* rule : g.find_all<Rule>([this](const Rule& r) { return in_scope(r); })) {
+        for (Reference* ref : rule->find_all<Reference>()) {
+            used[ref->get_name()]++;
+        }
+    }
+    long size = 0;
+    for (Rule* rule : g.find_all<Rule>()) {
+        if (in_scope(*rule)) {
+            size += CostModel::rule(*rule);
+        } else if (used.count(rule->get_name())) {
+            int refs = used[rule->get_name()];
+            size += CostModel::rule(*rule) * refs / (refs + outside[rule->get_name()]);
+        }
+    }
+    growth = 0;
+    growth_budget = size * Config::get<int>("max-growth") / 100;
+    // with time budget, the best grammar seen so far is remembered, to be used if the time runs out
+    std::optional<Grammar> best;
+    long best_cost = 0;
+    if (Config::get<double>("opt-time-budget") > 0) {
+        best.emplace(g);
+        best_cost = cost();
+    }
     while (opts > 0) {
+        if (out_of_time()) {
+            log(1, "Optimization time budget exhausted after %d passes, using the best grammar found", pass - 1);
+            g = *best;
+            g.update_parents();
+            analysis.update();
+            return false;
+        }
         log(2, "Optimization pass %d", pass);
-        opts = normalize_character_classes();
+        opts = optimize_rules();
+        opts += left_recursion();
         opts += inline_rules();
-        opts += remove_unnecessary_groups();
-        opts += single_char_character_classes();
-        //~ opts += character_class_negations();
-        opts += double_negations();
-        opts += double_quantifications();
-        opts += simplify_repeats();
-        opts += concat_strings();
-        opts += concat_character_classes();
-        opts += unused_variables();
-        opts += unused_captures();
         if (opts) debug("Grammar after pass %d (%d optimizations):\n%s", pass, opts, STR(g));
+        if (best && opts) {
+            long current = cost();
+            if (current <= best_cost) {
+                best = g;
+                best_cost = current;
+            }
+        }
         pass++;
     }
+    return true;
+}
+
+Grammar Optimizer::optimize() {
+    debug("Input grammar:\n%s", STR(g));
+    analysis.update();
+    unreachable_rules();
+    merge_rules();
+    std::vector<std::vector<std::string>> all = units();
+    std::string start = g.find_all<Rule>().empty() ? "" : g.find_all<Rule>()[0]->get_name();
+    std::map<std::string, std::string> digests;  // describes final form of each optimized rule and all it uses
+    int reused = 0;
+    deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(Config::get<double>("opt-time-budget")));
+    for (int i = 0; i < all.size(); i++) {
+        if (out_of_time()) {
+            log(1, "Optimization time budget exhausted, %ld units were not optimized", all.size() - i);
+            break;
+        }
+        scope = std::set<std::string>(all[i].begin(), all[i].end());
+        count_outside_references();
+        std::set<std::string> used = referenced();
+        std::string key = cache ? this->key(scope.count(start) > 0, digests) : "";
+        std::string cached;
+        if (cache && cache->find(key, cached)) {
+            log(2, "Reusing optimized unit of %ld rules starting with %s", all[i].size(), all[i][0].c_str());
+            reuse(cached);
+            reused++;
+        } else {
+            log(2, "Optimizing unit of %ld rules starting with %s", all[i].size(), all[i][0].c_str());
+            // partially optimized units must not be cached
+            if (optimize_unit() && cache) {
+                cache->store(key, source(false));
+            }
+        }
+        referenced_before.insert(used.begin(), used.end());
+        if (cache) {
+            std::string digest = std::to_string(std::hash<std::string>()(key + source(false)));
+            for (const std::string& name : all[i]) {
+                digests[name] = digest;
+            }
+        }
+    }
+    scope.clear();
+    unused_rules();
+    // removing dead alternatives might have left some rules unused
+    unreachable_rules();
+    // and optimizations might have made some rules identical
+    merge_rules();
+    if (Config::get(O_REORDER_RULES)) {
+        reorder_rules();
+    }
+    if (cache) {
+        log(1, "Reused %d of %ld optimized units", reused, all.size());
+    }
     return g;
 }
@@ -1,27 +1,78 @@
 #pragma once
 #include "ast/grammar.h"
+#include "analysis.h"
 #include "config.h"
+#include "incremental.h"
+#include "rewrite.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <map>
+#include <set>
 
 class Optimizer {
     Grammar& g;
+    Analysis analysis;
+    Rewriter rewriter;
+    Cache* cache;
+    std::set<std::string> scope;              // names of rules being optimized, rules are optimized unit by unit
+    std::set<std::string> dirty;              // rules changed since the rule-local passes were last applied to them
+    std::map<std::string, int> outside;       // number of references to each rule from rules outside of the scope
+    std::set<std::string> referenced_before;  // rules referenced by the grammar before optimization
+    long growth;                              // estimated growth of code caused by inlining in current unit
+    long growth_budget;                       // maximal allowed growth in current unit
+    std::chrono::steady_clock::time_point deadline;  // when to stop optimizing, only used with --opt-time-budget
+    ThreadPool pool;
+
+    bool in_scope(const Rule& rule) const;
+    std::vector<std::vector<std::string>> units();
+    void count_outside_references();
+    std::set<std::string> referenced();
+    std::string source(bool start);
+    std::string key(bool start, const std::map<std::string, std::string>& digests);
+    void reuse(const std::string& cached);
+    int unused_rules();
+    bool optimize_unit();
+    bool out_of_time() const;
+    long cost();
+    int optimize_rules();
+    int optimize_rule(Rule& rule);
 
-    int apply(const Optimization& config, const std::function<bool(Node&, int&)>& transform);
+    template <class Transform>
+    int apply(Rule& rule, const Optimization& config, const Transform& transform);
 
     int inline_rules();
-    int concat_strings();
-    int concat_character_classes();
-    int normalize_character_classes();
-    int single_char_character_classes();
-    int character_class_negations();
-    int double_negations();
-    int double_quantifications();
-    int simplify_repeats();
-    int remove_unnecessary_groups();
-    int unused_variables();
-    int unused_captures();
+    int left_recursion();
+    std::map<std::string, std::set<std::string>> referrers();
+    bool eliminate_left_recursion(
+        Rule& rule,
+        const std::map<std::string, Rule*>& rules,
+        const std::map<std::string, std::set<std::string>>& referrers,
+        std::set<std::string>& expanded
+    );
+    bool left_reaches(const std::map<std::string, Rule*>& rules, const std::string& from, const std::string& to) const;
+    std::set<std::string> left_references(Alternation& a) const;
+    int unreachable_rules();
+    int reorder_rules();
+    int merge_rules();
+    int dead_alternatives(Rule& rule);
+    int concat_strings(Rule& rule);
+    int concat_character_classes(Rule& rule);
+    int normalize_character_classes(Rule& rule);
+    int single_char_character_classes(Rule& rule);
+    int character_class_negations(Rule& rule);
+    int lookaheads(Rule& rule);
+    int remove_unnecessary_groups(Rule& rule);
+    int unused_variables(Rule& rule);
+    int unused_captures(Rule& rule);
+    int left_factoring(Rule& rule);
+    int keyword_tries(Rule& rule);
+    int char_alternatives(Rule& rule);
 public:
     static void warn_once(const std::string& warning);
+    static std::string signature();
 
-    Optimizer(Grammar& g);
+    Optimizer(Grammar& g, Cache* cache = nullptr);
     Grammar optimize();
+    int remove_dead_code();
 };
@@ -2,6 +2,8 @@
 #include "log.h"
 #include "utils.h"
 
+#include <map>
+
 Parser::State::State(Parser* p) : p(p), saved_pos(p->pos) {};
 
 bool Parser::State::rollback() {
@@ -72,13 +74,18 @@ bool Parser::match(const std::string& str) {
 bool Parser::match_re(const std::string& r, bool space) {
     State s(this);
     if (space) skip_space();
+    // compiling the expression takes longer than matching it, so each is compiled only once
+    static thread_local std::map<std::string, std::regex> compiled;
+    std::map<std::string, std::regex>::iterator re = compiled.find(r);
+    if (re == compiled.end()) {
+        re = compiled.emplace(r, std::regex(r)).first;
+    }
     std::smatch m;
-    if (std::regex_search(input.cbegin() + pos, input.cend(), m, std::regex(r))) {
-        if (m.position(0) == 0) {
-            pos += m.length(0);
-            last_re_match = m;
-            return s.commit();
-        }
+    // only match at current position, searching the rest of the input would make parsing quadratic
+    if (std::regex_search(input.cbegin() + pos, input.cend(), m, re->second, std::regex_constants::match_continuous)) {
+        pos += m.length(0);
+        last_re_match = m;
+        return s.commit();
     }
     return s.rollback();
 }
@@ -0,0 +1,240 @@
+#include "rewrite.h"
+#include "optimizer.h"
+#include "ast/visit.h"
+#include "utils.h"
+#include "log.h"
+
+#include <algorithm>
+#include <string.h>
+
+static const char VARIABLES[] = "XYZW";
+
+const std::vector<Rewriter::Pattern> Rewriter::patterns = {
+    // negation of negation can be ignored
+    {O_DOUBLE_NEGATION, "!(!X)", "X"},
+    // (A?)? -> A?, (A+)+ -> A+, any other combination of quantifiers results in A*
+    {O_DOUBLE_QUANTIFICATION, "(X*)*", "X*"},
+    {O_DOUBLE_QUANTIFICATION, "(X*)+", "X*"},
+    {O_DOUBLE_QUANTIFICATION, "(X*)?", "X*"},
+    {O_DOUBLE_QUANTIFICATION, "(X+)*", "X*"},
+    {O_DOUBLE_QUANTIFICATION, "(X+)+", "X+"},
+    {O_DOUBLE_QUANTIFICATION, "(X+)?", "X*"},
+    {O_DOUBLE_QUANTIFICATION, "(X?)*", "X*"},
+    {O_DOUBLE_QUANTIFICATION, "(X?)+", "X*"},
+    {O_DOUBLE_QUANTIFICATION, "(X?)?", "X?"},
+    // repeated terms, greedy repetition followed by the same term can never match
+    {O_REPEATS, "X* X*", "X*"},
+    {O_REPEATS, "X* X?", "X*"},
+    {O_REPEATS, "X* X+", nullptr},
+    {O_REPEATS, "X* X", nullptr},
+    {O_REPEATS, "X+ X*", "X+"},
+    {O_REPEATS, "X+ X?", "X+"},
+    {O_REPEATS, "X+ X+", nullptr},
+    {O_REPEATS, "X+ X", nullptr},
+    {O_REPEATS, "X? X*", "X*"},
+    {O_REPEATS, "X? X+", "X X+"},
+    {O_REPEATS, "X? X", "X X?"},
+    {O_REPEATS, "X X*", "X+"},
+};
+
+Rewriter::Rewriter() : depth(1) {
+    for (const Pattern& pattern : patterns) {
+        if (!Config::get(pattern.optimization)) continue;
+        std::vector<PatternTerm> from = parse(pattern.from);
+        Compiled compiled = {&pattern, pattern.to ? parse(pattern.to) : std::vector<PatternTerm>(), {}};
+        std::string k = key(from, compiled.variables);
+        for (const PatternTerm& term : compiled.to) {
+            // only bound variables can be used in the result
+            if (!term.variable || !compiled.variables.count(term.variable)) {
+                error("Invalid rewrite pattern '%s'", pattern.to);
+            }
+        }
+        for (const PatternTerm& term : from) {
+            depth = std::max(depth, depth_of(term));
+        }
+        if (from.size() == 1 && pattern.to) {
+            term_patterns[k] = compiled;
+        } else if (from.size() == 2) {
+            pair_patterns[k] = compiled;
+        } else {
+            error("Invalid rewrite pattern '%s'", pattern.from);
+        }
+    }
+}
+
+std::vector<Rewriter::PatternTerm> Rewriter::parse(const char* pattern) {
+    std::vector<PatternTerm> result;
+    const char* pos = pattern;
+    while (*pos) {
+        result.push_back(parse_term(pos, pattern));
+        while (*pos == ' ') pos++;
+    }
+    return result;
+}
+
+Rewriter::PatternTerm Rewriter::parse_term(const char*& pos, const char* pattern) {
+    PatternTerm result = {0, 0, 0, {}};
+    if (*pos == '!' || *pos == '&') {
+        result.prefix = *pos++;
+    }
+    if (strchr(VARIABLES, *pos) && *pos) {
+        result.variable = *pos++;
+    } else if (*pos == '(') {
+        pos++;
+        result.inner.push_back(parse_term(pos, pattern));
+        if (*pos++ != ')') {
+            error("Invalid rewrite pattern '%s'", pattern);
+        }
+    } else {
+        error("Invalid rewrite pattern '%s'", pattern);
+    }
+    if (*pos == '*' || *pos == '+' || *pos == '?') {
+        result.quantifier = *pos++;
+    }
+    return result;
+}
+
+int Rewriter::depth_of(const PatternTerm& term) {
+    return term.variable ? 1 : 1 + depth_of(term.inner[0]);
+}
+
+std::string Rewriter::key(const std::vector<PatternTerm>& terms, std::map<char, int>& variables) {
+    // variables are renamed in order of appearance, the same way as in shapes of matched terms
+    std::string result;
+    for (const PatternTerm& term : terms) {
+        if (!result.empty()) result += ' ';
+        key(term, variables, result);
+    }
+    return result;
+}
+
+void Rewriter::key(const PatternTerm& term, std::map<char, int>& variables, std::string& result) {
+    if (term.prefix) result += term.prefix;
+    if (term.variable) {
+        std::map<char, int>::iterator it = variables.emplace(term.variable, variables.size()).first;
+        result += VARIABLES[it->second];
+    } else {
+        result += '(';
+        key(term.inner[0], variables, result);
+        result += ')';
+    }
+    if (term.quantifier) result += term.quantifier;
+}
+
+void Rewriter::shapes(const Term& term, int depth, const Shape& current, std::vector<Shape>& result) const {
+    std::string prefix = term.get_prefix() ? std::string(1, term.get_prefix()) : "";
+    std::string quantifier = term.get_quantifier() ? std::string(1, term.get_quantifier()) : "";
+    // group with single term can be matched by nested pattern, these are more specific, so they go first
+    if (depth > 1 && term.contains<Group>() && term.get<Group>().has_single_term()) {
+        std::vector<Shape> inner;
+        Shape open = current;
+        open.key += prefix + "(";
+        shapes(term.get<Group>().get_first_term(), depth - 1, open, inner);
+        for (Shape& shape : inner) {
+            shape.key += ")" + quantifier;
+            result.push_back(shape);
+        }
+    }
+    // or the whole content is bound to a variable
+    Shape shape = current;
+    int index = std::find_if(shape.bindings.begin(), shape.bindings.end(), [&term](const Term* bound) {
+        return bound->same_content(term);
+    }) - shape.bindings.begin();
+    if (index == shape.bindings.size()) {
+        if (index == sizeof(VARIABLES) - 1) return;
+        shape.bindings.push_back(&term);
+    }
+    shape.key += prefix + VARIABLES[index] + quantifier;
+    result.push_back(shape);
+}
+
+Term Rewriter::instantiate(const PatternTerm& term, const Compiled& compiled, const Shape& shape) const {
+    Term result(term.prefix, term.quantifier, Primary(), nullptr);
+    result.copy_content(*shape.bindings[compiled.variables.at(term.variable)]);
+    return result;
+}
+
+bool Rewriter::rewrite_term(Term& term) const {
+    if (term_patterns.empty()) {
+        return false;
+    }
+    std::vector<Shape> candidates;
+    shapes(term, depth, Shape(), candidates);
+    for (const Shape& shape : candidates) {
+        std::map<std::string, Compiled>::const_iterator it = term_patterns.find(shape.key);
+        if (it == term_patterns.end()) continue;
+        Term result = instantiate(it->second.to[0], it->second, shape);
+        log(1, "Rewriting '%s' to '%s' (%s -> %s)", STR(term), STR(result), it->second.pattern->from, it->second.pattern->to);
+        Node* parent = term.parent;
+        term = result;
+        term.parent = parent;
+        term.update_parents();
+        return true;
+    }
+    return false;
+}
+
+int Rewriter::rewrite_pair(Sequence& s, int pos) const {
+    std::vector<Shape> first;
+    shapes(s.get(pos - 1), depth, Shape(), first);
+    std::vector<Shape> candidates;
+    for (const Shape& shape : first) {
+        Shape separated = shape;
+        separated.key += ' ';
+        shapes(s.get(pos), depth, separated, candidates);
+    }
+    for (const Shape& shape : candidates) {
+        std::map<std::string, Compiled>::const_iterator it = pair_patterns.find(shape.key);
+        if (it == pair_patterns.end()) continue;
+        const Compiled& compiled = it->second;
+        std::string matched = s.get(pos - 1).to_string() + " " + s.get(pos).to_string();
+        if (!compiled.pattern->to) {
+            Alternation* a = s.parent->as<Alternation>();
+            if (a->size() > 1) {
+                log(1, "Removing %s from %s", STR(s), STR(*a));
+                a->erase(&s);
+                return 2;
+            }
+            Optimizer::warn_once("Detected sequence that will never match: " + matched);
+            return 0;
+        }
+        std::vector<Term> terms;
+        for (const PatternTerm& term : compiled.to) {
+            terms.push_back(instantiate(term, compiled, shape));
+        }
+        Sequence replacement(terms, nullptr);
+        log(1, "Rewriting '%s' to '%s' (%s -> %s)", matched.c_str(), STR(replacement), compiled.pattern->from, compiled.pattern->to);
+        s.erase(pos);
+        s.erase(pos - 1);
+        s.insert(pos - 1, replacement);
+        s.update_parents();
+        return 1;
+    }
+    return 0;
+}
+
+int Rewriter::rewrite(Rule& rule) const {
+    int optimized = 0;
+    rule.map([this, &optimized](Node& node) -> bool {
+        if (Term* t = node.as<Term>()) {
+            while (rewrite_term(*t)) {
+                optimized++;
+            }
+        } else if (Sequence* s = node.as<Sequence>()) {
+            for (int i = 1; i < s->size(); i++) {
+                int result = rewrite_pair(*s, i);
+                if (result == 2) {
+                    // the whole sequence was removed, so the traversal can't continue
+                    optimized++;
+                    return true;
+                } else if (result == 1) {
+                    // the replacement might form new pairs with its neighbours
+                    optimized++;
+                    i = std::max(0, i - 2);
+                }
+            }
+        }
+        return false;
+    });
+    return optimized;
+}
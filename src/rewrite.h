@@ -0,0 +1,57 @@
+#pragma once
+#include "ast/rule.h"
+#include "config.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Peephole rewrites of single terms or pairs of adjacent terms, written as patterns, e.g. "(X+)?" -> "X*".
+// Capital letters are variables standing for content of a term, the same variable must match the same content.
+// Patterns are compiled into a table keyed by shape of the matched terms, so that all of them are tested
+// at each node during a single traversal of the rule.
+class Rewriter {
+public:
+    struct Pattern {
+        Optimization optimization;
+        const char* from;
+        const char* to;  // nullptr if the matched sequence can never succeed
+    };
+    static const std::vector<Pattern> patterns;
+
+private:
+    struct PatternTerm {
+        char prefix;
+        char quantifier;
+        char variable;                    // 0 for group
+        std::vector<PatternTerm> inner;   // single term in the group
+    };
+    struct Compiled {
+        const Pattern* pattern;
+        std::vector<PatternTerm> to;
+        std::map<char, int> variables;    // index of the term bound to each variable
+    };
+    struct Shape {
+        std::string key;
+        std::vector<const Term*> bindings;
+    };
+
+    std::map<std::string, Compiled> term_patterns;
+    std::map<std::string, Compiled> pair_patterns;
+    int depth;  // maximum nesting of groups in patterns
+
+    static std::vector<PatternTerm> parse(const char* pattern);
+    static PatternTerm parse_term(const char*& pos, const char* pattern);
+    static int depth_of(const PatternTerm& term);
+    static std::string key(const std::vector<PatternTerm>& terms, std::map<char, int>& variables);
+    static void key(const PatternTerm& term, std::map<char, int>& variables, std::string& result);
+    void shapes(const Term& term, int depth, const Shape& current, std::vector<Shape>& result) const;
+    Term instantiate(const PatternTerm& term, const Compiled& compiled, const Shape& shape) const;
+
+    bool rewrite_term(Term& term) const;
+    int rewrite_pair(Sequence& s, int pos) const;
+
+public:
+    Rewriter();  // compiles patterns of enabled optimizations
+    int rewrite(Rule& rule) const;
+};
@@ -0,0 +1,320 @@
+#include "server.h"
+#include "checker.h"
+#include "ast/grammar.h"
+#include "utils.h"
+#include "log.h"
+
+#include <filesystem>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// Requests and responses are sent as a sequence of length prefixed strings:
+//   request:  cwd, PCC_IMPORT_PATH, number of arguments, arguments..., stdin
+//   response: exit status, stdout, stderr
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int) {
+    stopping = 1;
+}
+
+static void write_all(int fd, const char* data, std::size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            error("Failed to send data: %s", strerror(errno));
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+static void read_all(int fd, char* data, std::size_t size) {
+    while (size > 0) {
+        ssize_t count = read(fd, data, size);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) {
+            error("Failed to receive data: %s", count ? strerror(errno) : "connection closed");
+        }
+        data += count;
+        size -= count;
+    }
+}
+
+static void send_number(int fd, uint32_t n) {
+    write_all(fd, (const char*)&n, sizeof(n));
+}
+
+static uint32_t receive_number(int fd) {
+    uint32_t n;
+    read_all(fd, (char*)&n, sizeof(n));
+    return n;
+}
+
+static void send_string(int fd, const std::string& s) {
+    send_number(fd, s.size());
+    write_all(fd, s.data(), s.size());
+}
+
+static std::string receive_string(int fd) {
+    std::string result(receive_number(fd), '\0');
+    read_all(fd, result.data(), result.size());
+    return result;
+}
+
+static std::string read_stream(FILE* f) {
+    std::string result;
+    char buffer[4096];
+    fseek(f, 0, SEEK_SET);
+    while (std::size_t count = fread(buffer, 1, sizeof(buffer), f)) {
+        result.append(buffer, count);
+    }
+    return result;
+}
+
+static sockaddr_un address(const std::string& socket) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socket.size() >= sizeof(addr.sun_path)) {
+        error("Socket path '%s' is too long", socket.c_str());
+    }
+    strcpy(addr.sun_path, socket.c_str());
+    return addr;
+}
+
+Server::Server(const std::string& socket) : socket(socket), fd(-1) {
+    sockaddr_un addr = address(socket);
+    struct stat st;
+    if (lstat(socket.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            error("File '%s' already exists and is not a socket", socket.c_str());
+        }
+        // only a socket nobody listens on is left behind by a server that was killed
+        int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe < 0) {
+            error("Failed to create socket: %s", strerror(errno));
+        }
+        int connected = connect(probe, (sockaddr*)&addr, sizeof(addr));
+        int probe_errno = errno;
+        close(probe);
+        if (connected == 0) {
+            error("Another server is already listening on '%s'", socket.c_str());
+        } else if (probe_errno != ECONNREFUSED) {
+            error("Failed to check socket '%s': %s", socket.c_str(), strerror(probe_errno));
+        }
+        log(1, "Removing stale socket %s", socket.c_str());
+        unlink(socket.c_str());
+    }
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    // requests may read and write any files the server can, so only the owner may connect,
+    // the permissions are set already when the socket is created, so that nobody else can connect in between
+    mode_t mask = umask(077);
+    int bound = fd < 0 ? -1 : bind(fd, (sockaddr*)&addr, sizeof(addr));
+    int bind_errno = errno;
+    umask(mask);
+    if (bound != 0) {
+        error("Failed to create socket '%s': %s", socket.c_str(), strerror(bind_errno));
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        error("Failed to listen on socket '%s': %s", socket.c_str(), strerror(errno));
+    }
+}
+
+Server::~Server() {
+    if (fd >= 0) {
+        close(fd);
+        unlink(socket.c_str());
+    }
+}
+
+int Server::serve(const Handler& handler) {
+    struct sigaction sa = {};
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    log(0, "Listening on %s", socket.c_str());
+    int requests = 0;
+    while (!stopping) {
+        int connection = accept(fd, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR) continue;
+            error("Failed to accept connection: %s", strerror(errno));
+        }
+        try {
+            handle(connection, handler);
+            requests++;
+        } catch (int) {
+            // error was already reported, just keep serving other requests
+        }
+        close(connection);
+    }
+    log(0, "Stopped after processing %d requests", requests);
+    return 0;
+}
+
+// Files used to pass a request to the forked process and its results back, closed when the request is
+// done, even if it failed or the client disconnected
+struct RequestFiles {
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    FILE* err = tmpfile();
+    FILE* imports = tmpfile();
+    int cache[2] = {-1, -1};
+
+    ~RequestFiles() {
+        for (FILE* f : {in, out, err, imports}) {
+            if (f) fclose(f);
+        }
+        for (int fd : cache) {
+            if (fd >= 0) close(fd);
+        }
+    }
+};
+
+void Server::handle(int connection, const Handler& handler) {
+    std::string cwd = receive_string(connection);
+    std::string import_path = receive_string(connection);
+    std::vector<std::string> arguments(receive_number(connection));
+    for (std::string& arg : arguments) {
+        arg = receive_string(connection);
+    }
+    std::string input = receive_string(connection);
+    log(1, "Processing request from %s with %ld arguments", cwd.c_str(), arguments.size());
+
+    // Use unnamed temporary files instead of pipes, so that neither side can block on full buffer
+    RequestFiles files;
+    FILE* in = files.in;
+    FILE* out = files.out;
+    FILE* err = files.err;
+    FILE* imports = files.imports;
+    int* cache = files.cache;
+    if (!in || !out || !err || !imports || pipe(cache) != 0) {
+        error("Failed to prepare request: %s", strerror(errno));
+    }
+    fwrite(input.data(), 1, input.size(), in);
+    fflush(in);
+    fseek(in, 0, SEEK_SET);
+    fflush(stdout);
+    fflush(stderr);
+
+    // Each request runs in its own process, so global state of PackCC and any leaked
+    // memory are thrown away, while the server still keeps everything it has cached.
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        close(fd);
+        close(connection);
+        close(cache[0]);
+        dup2(fileno(in), STDIN_FILENO);
+        dup2(fileno(out), STDOUT_FILENO);
+        dup2(fileno(err), STDERR_FILENO);
+        if (chdir(cwd.c_str()) != 0) {
+            fprintf(stderr, "ERROR: Failed to change directory to '%s': %s\n", cwd.c_str(), strerror(errno));
+            std::exit(1);
+        }
+        if (import_path.empty()) {
+            unsetenv("PCC_IMPORT_PATH");
+        } else {
+            setenv("PCC_IMPORT_PATH", import_path.c_str(), 1);
+        }
+        Checker::share_cache(cache[1]);
+        Grammar::share_imports(fileno(imports));
+        std::exit(handler(arguments));
+    }
+    close(cache[1]);
+    cache[1] = -1;
+
+    int status = 1;
+    if (pid < 0) {
+        fprintf(err, "ERROR: Failed to fork: %s\n", strerror(errno));
+    } else if (waitpid(pid, &status, 0) < 0) {
+        fprintf(err, "ERROR: Failed to wait for request: %s\n", strerror(errno));
+        status = 1;
+    } else if (WIFSIGNALED(status)) {
+        fprintf(err, "ERROR: Request was terminated by signal %d\n", WTERMSIG(status));
+        status = 128 + WTERMSIG(status);
+    } else {
+        status = WEXITSTATUS(status);
+    }
+    Checker::load_cache(cache[0]);
+
+    std::string output = read_stream(out);
+    std::string errors = read_stream(err);
+    log(1, "Request finished with exit status %d", status);
+
+    send_number(connection, status);
+    send_string(connection, output);
+    send_string(connection, errors);
+
+    // imports parsed by the request are parsed again here, after the client got its response,
+    // so that the following requests can reuse them
+    lseek(fileno(imports), 0, SEEK_SET);
+    Grammar::load_imports(fileno(imports));
+}
+
+Client::Client(const std::string& socket) : socket(socket) {}
+
+int Client::request(const Config& conf, int argc, char **argv) {
+    std::vector<std::string> arguments;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-C") == 0 || strcmp(argv[i], "--connect") == 0) {
+            i++;
+            continue;
+        }
+        arguments.push_back(argv[i]);
+    }
+
+    // standard input is only forwarded when it is actually used, so that client doesn't wait for it needlessly
+    std::string input;
+    if (contains(conf.inputs, "")) {
+        input = read_file("");
+    }
+    const char* import_path = getenv("PCC_IMPORT_PATH");
+
+    signal(SIGPIPE, SIG_IGN);
+    sockaddr_un addr = address(socket);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        error("Failed to connect to server at '%s': %s", socket.c_str(), strerror(errno));
+    }
+    log(1, "Sending request to %s ...", socket.c_str());
+
+    int status;
+    std::string output, errors;
+    try {
+        send_string(fd, std::filesystem::current_path().native());
+        send_string(fd, import_path ? import_path : "");
+        send_number(fd, arguments.size());
+        for (const std::string& arg : arguments) {
+            send_string(fd, arg);
+        }
+        send_string(fd, input);
+
+        status = receive_number(fd);
+        output = receive_string(fd);
+        errors = receive_string(fd);
+    } catch (int) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    fwrite(output.data(), 1, output.size(), stdout);
+    fwrite(errors.data(), 1, errors.size(), stderr);
+    return status;
+}
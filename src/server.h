@@ -0,0 +1,30 @@
+#pragma once
+#include "config.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class Server {
+public:
+    using Handler = std::function<int(const std::vector<std::string>& arguments)>;
+
+    Server(const std::string& socket);
+    ~Server();
+
+    int serve(const Handler& handler);
+
+private:
+    std::string socket;
+    int fd;
+
+    void handle(int connection, const Handler& handler);
+};
+
+class Client {
+    std::string socket;
+public:
+    Client(const std::string& socket);
+
+    int request(const Config& conf, int argc, char **argv);
+};
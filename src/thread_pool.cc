@@ -0,0 +1,108 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int size) : task(nullptr), batch(0), pending(0), stopping(false) {
+    for (int i = 0; i < std::max(size, 1); i++) {
+        queues.emplace_back(new Queue);
+    }
+    // the calling thread works too, so it acts as worker 0
+    for (int i = 1; i < size; i++) {
+        threads.emplace_back(&ThreadPool::loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    started.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+int ThreadPool::size() const {
+    return queues.size();
+}
+
+bool ThreadPool::next(int worker, int& index) {
+    // own tasks are taken from the back, stolen ones from the front of other queues
+    for (int i = 0; i < queues.size(); i++) {
+        Queue& queue = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        if (i == 0) {
+            index = queue.tasks.back();
+            queue.tasks.pop_back();
+        } else {
+            index = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::work(int worker) {
+    int index;
+    while (next(worker, index)) {
+        try {
+            (*task)(index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) {
+            finished.notify_all();
+        }
+    }
+}
+
+void ThreadPool::loop(int worker) {
+    int seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            started.wait(lock, [&]{ return stopping || batch != seen; });
+            if (stopping) return;
+            seen = batch;
+        }
+        work(worker);
+    }
+}
+
+void ThreadPool::run(int count, const std::function<void(int)>& task) {
+    if (queues.size() == 1 || count < 2) {
+        for (int i = 0; i < count; i++) {
+            task(i);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = &task;
+        failure = nullptr;
+        pending = count;
+    }
+    for (int i = 0; i < count; i++) {
+        Queue& queue = *queues[i % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(i);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch++;
+    }
+    started.notify_all();
+    work(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]{ return pending == 0; });
+    this->task = nullptr;
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads executing batches of independent tasks. Each thread has its own queue
+// and when it runs out of work, it steals tasks from the others, so that few expensive tasks
+// don't keep the other threads idle.
+class ThreadPool {
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Queue>> queues;
+    const std::function<void(int)>* task;
+    std::exception_ptr failure;
+
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    int batch;
+    int pending;
+    bool stopping;
+
+    bool next(int worker, int& index);
+    void work(int worker);
+    void loop(int worker);
+public:
+    ThreadPool(int size);
+    ~ThreadPool();
+
+    int size() const;
+
+    // Calls task(0) ... task(count - 1) and waits until all of them finish, first exception is rethrown
+    void run(int count, const std::function<void(int)>& task);
+};
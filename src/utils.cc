@@ -8,6 +8,8 @@
 #include <regex>
 #include <filesystem>
 
+#include <unistd.h>
+
 std::string read_file(const std::string& filename) {
     std::stringstream buffer;
     buffer << (filename.empty() ? std::cin.rdbuf() : std::ifstream(filename).rdbuf());
@@ -17,10 +19,45 @@ std::string read_file(const std::string& filename) {
 void write_file(const std::string& filename, const std::string& content) {
     if (filename.empty()) {
         printf("%s", content.c_str());
-    } else {
+        return;
+    }
+
+    // keep the file untouched if nothing changed, so that build systems don't consider it modified
+    namespace fs = std::filesystem;
+    bool exists = fs::exists(filename);
+    if (exists && !fs::is_regular_file(filename)) {
+        // devices and pipes (e.g. /dev/null or /dev/stdout) can't be compared nor replaced
         std::ofstream ofs(filename);
         ofs << content;
         ofs.close();
+        if (ofs.fail()) {
+            error("Failed to write file '%s'", filename.c_str());
+        }
+        return;
+    }
+    if (exists && fs::file_size(filename) == content.size() && read_file(filename) == content) {
+        debug("File '%s' is up to date.", filename.c_str());
+        return;
+    }
+
+    // write to temporary file and rename it, so that nobody ever sees partially written file
+    fs::path target = exists ? fs::canonical(filename) : fs::path(filename);
+    fs::path tmp = target.native() + ".tmp" + std::to_string(getpid());
+    std::ofstream ofs(tmp);
+    ofs << content;
+    ofs.close();
+    std::error_code ec;
+    if (ofs.fail()) {
+        fs::remove(tmp, ec);
+        error("Failed to write file '%s'", filename.c_str());
+    }
+    if (exists) {
+        fs::permissions(tmp, fs::status(target).permissions(), ec);
+    }
+    fs::rename(tmp, target, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        error("Failed to write file '%s'", filename.c_str());
     }
 }
 
@@ -98,3 +135,7 @@ std::string replace(const std::string& input, const std::string& re, const std::
 std::string left_pad(const std::string& s, int width) {
     return std::string(width - s.size(), ' ') + s;
 }
+
+std::string right_pad(const std::string& s, int width) {
+    return s + std::string(width - s.size(), ' ');
+}
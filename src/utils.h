@@ -28,3 +28,4 @@ std::vector<std::string> split(const std::string &s, const std::string& delimite
 bool contains(std::vector<std::string> values, std::string x);
 std::string replace(const std::string& input, const std::string& re, const std::string& replace);
 std::string left_pad(const std::string& s, int width);
+std::string right_pad(const std::string& s, int width);
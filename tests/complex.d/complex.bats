@@ -51,6 +51,22 @@ PEGOF="${PEGOF/_test/}"
     check_stdout "complex.d/json.out"
 }
 
+@test "complex.d - JSON parallel optimization" {
+    run_test "complex.d/json_parallel.conf" "complex.d/json.peg"
+    check_status complex.d/json_parallel.status
+    check_stdout "complex.d/json_parallel.out"
+}
+
+@test "complex.d - parallel optimization is deterministic" {
+    GRAMMARS=(complex.d/json.peg)
+    if [ "$INCLUDE_SLOW_TESTS" ]; then
+        GRAMMARS+=(complex.d/c.peg complex.d/kotlin.peg)
+    fi
+    for GRAMMAR in "${GRAMMARS[@]}"; do
+        diff -u <("$PEGOF" --optimize all --jobs 1 "$GRAMMAR") <("$PEGOF" --optimize all --jobs 4 "$GRAMMAR")
+    done
+}
+
 @test "complex.d - calc format" {
     run_test "complex.d/calc_format.conf" "complex.d/calc.peg"
     check_status complex.d/calc_format.status
@@ -62,3 +78,23 @@ PEGOF="${PEGOF/_test/}"
     check_status complex.d/calc.status
     check_stdout "complex.d/calc.out"
 }
+
+@test "complex.d - JSON code size estimate" {
+    run "$PEGOF" -v -v --optimize all complex.d/json.peg
+    [ "$status" -eq 0 ]
+    [[ "$output" = *"Code size of rules was estimated to "* ]]
+    [[ "$output" != *", 0 bytes were generated"* ]]
+}
+
+@test "complex.d - JSON stats per rule" {
+    run "$PEGOF" --stats-per-rule json --optimize all complex.d/json.peg
+    [ "$status" -eq 0 ]
+    [[ "$output" = *'{"input": ['*'{"rule": "object", "lines": '*'], "output": ['*'{"rule": "value", "lines": '*']}'* ]]
+    [[ "$output" != *'"bytes": 0,'* ]]
+}
+
+@test "complex.d - arith optimization" {
+    run_test "complex.d/arith.conf" "complex.d/arith.peg"
+    check_status complex.d/arith.status
+    check_stdout "complex.d/arith.out"
+}
@@ -0,0 +1,40 @@
+#!/usr/bin/env bats
+load "$TESTDIR/utils.sh"
+
+# Compiles parsers from original and optimized grammar and checks that both produce the same output
+run_differential() {
+    local NAME="$1" GRAMMAR="$2" INPUT="$3"
+    shift 3
+    if ! which "${CC:-cc}" &> /dev/null; then
+        skip "C compiler not found"
+    fi
+    "$PEGOF" --packcc --exclude all -o "$BATS_TMPDIR/${NAME}_orig" -i "$GRAMMAR"
+    "$PEGOF" --packcc "$@" -o "$BATS_TMPDIR/${NAME}_opt" -i "$GRAMMAR"
+    ${CC:-cc} "$BATS_TMPDIR/${NAME}_orig.c" -o "$BATS_TMPDIR/${NAME}_orig"
+    ${CC:-cc} "$BATS_TMPDIR/${NAME}_opt.c" -o "$BATS_TMPDIR/${NAME}_opt"
+    "$BATS_TMPDIR/${NAME}_orig" < "$INPUT" > "$BATS_TMPDIR/${NAME}_orig.txt"
+    "$BATS_TMPDIR/${NAME}_opt" < "$INPUT" > "$BATS_TMPDIR/${NAME}_opt.txt"
+    diff -u "$BATS_TMPDIR/${NAME}_orig.txt" "$BATS_TMPDIR/${NAME}_opt.txt"
+}
+
+@test "differential.d - kotlin keyword trie" {
+    if [ -z "$INCLUDE_SLOW_TESTS" ]; then
+        skip "slow test (set INCLUDE_SLOW_TESTS=1 to run this)"
+    fi
+    run_differential kotlin_trie "$ROOTDIR/benchmark/grammars/kotlin.peg" "$ROOTDIR/benchmark/inputs/kotlin.kt" --optimize keyword-trie
+}
+
+@test "differential.d - kotlin all optimizations" {
+    if [ -z "$INCLUDE_SLOW_TESTS" ]; then
+        skip "slow test (set INCLUDE_SLOW_TESTS=1 to run this)"
+    fi
+    run_differential kotlin_all "$ROOTDIR/benchmark/grammars/kotlin.peg" "$ROOTDIR/benchmark/inputs/kotlin.kt" --optimize all
+}
+
+@test "differential.d - calc all optimizations" {
+    run_differential calc_all "$ROOTDIR/benchmark/grammars/calc.peg" "$ROOTDIR/benchmark/inputs/calc.txt" --optimize all
+}
+
+@test "differential.d - arith all optimizations" {
+    run_differential arith_all "$ROOTDIR/benchmark/grammars/arith.peg" "$ROOTDIR/benchmark/inputs/calc.txt" --optimize all
+}
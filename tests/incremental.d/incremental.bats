@@ -0,0 +1,70 @@
+#!/usr/bin/env bats
+load "$TESTDIR/utils.sh"
+
+# Formats the grammar with and without format cache and checks that the results are the same
+check_incremental() {
+    diff -u <("$PEGOF" "$1") <("$PEGOF" --format-cache "$CACHE" --verify-cache "$1")
+}
+
+setup() {
+    CACHE="$BATS_TMPDIR/format_cache_$$"
+    rm -f "$CACHE"
+}
+
+teardown() {
+    rm -f "$CACHE" "$BATS_TMPDIR/edited.peg" "$BATS_TMPDIR/optimize_cache_$$"
+}
+
+@test "incremental.d - same as full formatting" {
+    for GRAMMAR in formatting.d/*.peg comments.d/*.peg complex.d/{c,json,kotlin}.peg; do
+        check_incremental "$GRAMMAR"
+        check_incremental "$GRAMMAR"
+    done
+}
+
+@test "incremental.d - edited grammar" {
+    check_incremental complex.d/json.peg
+    sed 's/^number <-/number <- "NaN" \//; /^# /d' complex.d/json.peg > "$BATS_TMPDIR/edited.peg"
+    run "$PEGOF" -v --format-cache "$CACHE" "$BATS_TMPDIR/edited.peg"
+    [[ "$output" = *"Reused "* ]]
+    [[ "$output" != *"Reused 0 of"* ]]
+    check_incremental "$BATS_TMPDIR/edited.peg"
+}
+
+@test "incremental.d - validation of changed rules" {
+    check_incremental complex.d/json.peg
+    sed 's/^number <-/number <- "NaN" \//' complex.d/json.peg > "$BATS_TMPDIR/edited.peg"
+    run "$PEGOF" -v --format-cache "$CACHE" "$BATS_TMPDIR/edited.peg"
+    [[ "$output" = *"Validating changed rules"* ]]
+    [[ "$output" != *"Validating input grammar"* ]]
+    # removed rule is still referenced from the unchanged ones, so the grammar must be validated as a whole
+    sed '/^number <-/d' complex.d/json.peg > "$BATS_TMPDIR/edited.peg"
+    run "$PEGOF" -v --format-cache "$CACHE" "$BATS_TMPDIR/edited.peg"
+    [[ "$output" = *"Validating input grammar"* ]]
+}
+
+@test "incremental.d - different options" {
+    check_incremental complex.d/json.peg
+    diff -u <("$PEGOF" --quotes single complex.d/json.peg) <("$PEGOF" --quotes single --format-cache "$CACHE" complex.d/json.peg)
+}
+
+@test "incremental.d - other pegof version" {
+    check_incremental complex.d/json.peg
+    head -n 1 "$CACHE" | grep -qF " $("$PEGOF" --version | sed -n 's/^Pegof version: //p') "
+    sed -i '1s/^\(pegof-cache [0-9]*\) [^ ]*/\1 other-version/' "$CACHE"
+    run "$PEGOF" -v --format-cache "$CACHE" complex.d/json.peg
+    [[ "$output" = *"was created by different version or with different options, ignoring it"* ]]
+}
+
+@test "incremental.d - optimization cache" {
+    OPT_CACHE="$BATS_TMPDIR/optimize_cache_$$"
+    for GRAMMAR in complex.d/json.peg incremental.d/components.peg; do
+        rm -f "$OPT_CACHE"
+        "$PEGOF" --optimize all --optimize-cache "$OPT_CACHE" --verify-cache "$GRAMMAR"
+        diff -u <("$PEGOF" --optimize all "$GRAMMAR") <("$PEGOF" --optimize all --optimize-cache "$OPT_CACHE" --verify-cache "$GRAMMAR")
+    done
+    sed 's/^number <- \[0-9\]+/number <- [0-9]+ ("." [0-9]+)?/' incremental.d/components.peg > "$BATS_TMPDIR/edited.peg"
+    run "$PEGOF" -v --optimize all --optimize-cache "$OPT_CACHE" --verify-cache "$BATS_TMPDIR/edited.peg"
+    [ "$status" -eq 0 ]
+    [[ "$output" = *"Reused 3 of 7 optimized units"* ]]
+}
@@ -0,0 +1,52 @@
+#!/usr/bin/env bats
+load "$TESTDIR/utils.sh"
+
+setup() {
+    SOCKET="$BATS_TMPDIR/pegof_$$.sock"
+    "$PEGOF" --serve "$SOCKET" 2> /dev/null &
+    SERVER=$!
+    for i in $(seq 50); do
+        [ -S "$SOCKET" ] && break
+        sleep 0.1
+    done
+}
+
+teardown() {
+    kill "$SERVER"
+    wait "$SERVER" || true
+    [ ! -e "$SOCKET" ]
+}
+
+@test "server.d - format file" {
+    diff -u <("$PEGOF" basic.d/basic.peg) <("$PEGOF" --connect "$SOCKET" basic.d/basic.peg)
+}
+
+@test "server.d - optimize stdin" {
+    diff -u <("$PEGOF" --optimize all < complex.d/json.peg) <("$PEGOF" --connect "$SOCKET" --optimize all < complex.d/json.peg)
+}
+
+@test "server.d - repeated requests" {
+    for i in 1 2 3; do
+        diff -u complex.d/calc_format.out <("$PEGOF" --connect "$SOCKET" complex.d/calc_format.out)
+    done
+}
+
+@test "server.d - error" {
+    run "$PEGOF" --connect "$SOCKET" server.d/missing.peg
+    [ "$status" -eq 1 ]
+    [ "$output" = "ERROR: Failed to read grammar 'server.d/missing.peg'" ]
+}
+
+@test "server.d - socket in use" {
+    run "$PEGOF" --serve "$SOCKET"
+    [ "$status" -eq 1 ]
+    [ "$output" = "ERROR: Another server is already listening on '$SOCKET'" ]
+    diff -u <("$PEGOF" basic.d/basic.peg) <("$PEGOF" --connect "$SOCKET" basic.d/basic.peg)
+}
+
+@test "server.d - imports" {
+    source import.d/setup.sh
+    for i in 1 2; do
+        diff -u import.d/import.out <("$PEGOF" --connect "$SOCKET" -c import.d/import.conf)
+    done
+}